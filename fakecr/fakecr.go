@@ -3,12 +3,15 @@ package main;
 import (
   "flag"
   "fmt"
+  "net/http"
   "os"
   "syscall"
   "net"
+  "time"
 
   "google.golang.org/grpc"
   "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+  "k8s.io/kubernetes/pkg/kubelet/server/streaming"
   "fakecr/service"
 )
 
@@ -20,13 +23,97 @@ var (
   bindir = flag.String("bindir", "/root/bin", "bindir")
 
   rootdir = flag.String("rootdir", "/root", "rootdir")
+
+  unspawnd = flag.String("unspawnd", "", "socket of unspawn daemon, start containers with bin/ct if empty")
+
+  registry = flag.String("registry", "", "registry of containers of the node, use pidfiles if empty")
+
+  cgroupRoot = flag.String("cgroup-root", "", "cgroup v2 directory to create container cgroups in, do not limit resources if empty")
+
+  pidsMax = flag.Int64("container-pids-max", 0, "pids.max of each container, unlimited if 0")
+
+  exclusiveCpus = flag.String("exclusive-cpus", "", "CPUs to pin containers of Guaranteed pods to exclusively, e.g. 2-7, other containers are pinned to the rest, no pinning if empty")
+
+  streamingAddr = flag.String("streaming-addr", "", "address for streaming server of exec and attach to listen on, e.g. 10.0.0.2:10010, disabled if empty")
+
+  execHelper = flag.Bool("exec-helper", false, "start an exec helper in each container for ExecSync, with unspawn daemon only. The helper is a child of the main process of the container.")
+
+  networkWorkers = flag.Int("network-workers", 8, "number of pod networks to set up or tear down at once, unbounded if 0")
+
+  configWorkers = flag.Int("config-workers", 32, "number of container configs to write at once, unbounded if 0")
+
+  spawnWorkers = flag.Int("spawn-workers", 16, "number of containers to start at once, unbounded if 0")
+
+  stageQueue = flag.Int("stage-queue", 256, "number of operations admitted to each of network, config and spawn stages, running or waiting, before new ones are rejected, unbounded if 0")
+
+  metricsAddr = flag.String("metrics-addr", "", "address for metrics of RPCs and external commands to be served on at /metrics, e.g. 127.0.0.1:10011, disabled if empty")
+
+  traceStartup = flag.Bool("trace-startup", false, "trace phases of starting each container, logged at -v=2 and served as metrics, with unspawn daemon only")
+
+  journal = flag.String("journal", "", "file to journal sandboxes and containers to, and recover them from on start, not kept if empty")
+
+  journalCompact = flag.Int("journal-compact", 10000, "number of records in journal before it is replaced by a snapshot")
+
+  netnsPool = flag.Int("netns-pool", 0, "number of network namespaces to prepare ahead of pod creation")
+
+  netnsRefill = flag.Duration("netns-pool-refill", time.Second, "interval between preparing two network namespaces")
 )
 
 func run(addr string) error {
-  server := grpc.NewServer()
+  server := grpc.NewServer(grpc.UnaryInterceptor(service.Interceptor))
+
+  if *metricsAddr != "" {
+    mux := http.NewServeMux()
+    mux.Handle("/metrics", service.MetricsHandler())
+    go func() {
+      if err := http.ListenAndServe(*metricsAddr, mux); err != nil {
+        fmt.Println("metrics server failed: ", err)
+      }
+    }()
+  }
+
+  runtimeService := service.NewFakeRuntimeService(node, rootdir, bindir, unspawnd, registry, cgroupRoot)
+  runtimeService.PidsMax = *pidsMax
+  runtimeService.ExecHelper = *execHelper && (*unspawnd != "")
+  runtimeService.TraceStartup = *traceStartup && (*unspawnd != "")
+  runtimeService.NetworkStage = service.NewStage("network", *networkWorkers, *stageQueue)
+  runtimeService.ConfigStage = service.NewStage("config", *configWorkers, *stageQueue)
+  runtimeService.SpawnStage = service.NewStage("spawn", *spawnWorkers, *stageQueue)
+  if *exclusiveCpus != "" {
+    cpus, err := service.NewCpuAllocator(*exclusiveCpus)
+    if err != nil {
+      return err
+    }
+    runtimeService.Cpus = cpus
+  }
+  if *netnsPool > 0 {
+    runtimeService.Pool = service.NewNetnsPool(*netnsPool, *netnsRefill, node, bindir)
+    go runtimeService.Pool.Run()
+  }
+
+  if *journal != "" {
+    if err := runtimeService.Recover(*journal, *journalCompact); err != nil {
+      return err
+    }
+  }
+
+  if *unspawnd != "" {
+    go runtimeService.Watch()
+  }
+
+  if *streamingAddr != "" {
+    config := streaming.DefaultConfig
+    config.Addr = *streamingAddr
+    streamingServer, err := streaming.NewServer(config, &service.StreamingRuntime{Service: runtimeService})
+    if err != nil {
+      return err
+    }
+    runtimeService.Streaming = streamingServer
+    go streamingServer.Start(true)
+  }
 
   runtime.RegisterImageServiceServer(server, service.NewFakeImageService(rootdir))
-  runtime.RegisterRuntimeServiceServer(server, service.NewFakeRuntimeService(node, rootdir, bindir))
+  runtime.RegisterRuntimeServiceServer(server, runtimeService)
 
   if err := syscall.Unlink(addr); err != nil && !os.IsNotExist(err) {
     return err
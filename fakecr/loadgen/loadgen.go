@@ -0,0 +1,309 @@
+package main;
+
+import (
+  "flag"
+  "fmt"
+  "net"
+  "os"
+  "sort"
+  "sync"
+  "time"
+
+  "golang.org/x/net/context"
+  "google.golang.org/grpc"
+  "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+)
+
+var (
+  endpoint = flag.String("endpoint", "/run/fake.sock", "socket fakecr listens on")
+
+  pods = flag.Int("pods", 100, "number of pods to run, each created, started, stopped and removed")
+
+  concurrency = flag.Int("concurrency", 8, "number of pods going through their lifecycle at once")
+
+  rate = flag.Float64("rate", 0, "number of pods to start a second, unlimited if 0")
+
+  containers = flag.Int("containers", 1, "number of containers of each pod")
+
+  image = flag.String("image", "hello", "image of containers")
+
+  hold = flag.Duration("hold", 0, "time containers are left running before they are stopped")
+
+  listers = flag.Int("listers", 1, "number of clients calling ListContainers in a loop, meanwhile")
+
+  listInterval = flag.Duration("list-interval", 100 * time.Millisecond, "interval between two ListContainers of each client")
+
+  timeout = flag.Duration("timeout", time.Minute, "timeout of each RPC")
+
+  prefix = flag.String("prefix", "loadgen", "prefix of names of pods, so that runs on the same fakecr do not clash")
+
+  tsv = flag.Bool("tsv", false, "print one line 'METHOD<TAB>CALLS<TAB>ERRORS<TAB>PER_SECOND<TAB>P50<TAB>P90<TAB>P99<TAB>MAX' for each RPC, latencies in seconds")
+)
+
+// latencies of one RPC
+type series struct {
+  durations []time.Duration
+  errors int
+}
+
+type recorder struct {
+  sync.Mutex
+  series map[string]*series
+}
+
+func (r *recorder) observe(method string, d time.Duration, err error) {
+  r.Lock()
+  defer r.Unlock()
+
+  s, ok := r.series[method]
+  if !ok {
+    s = &series{}
+    r.series[method] = s
+  }
+  s.durations = append(s.durations, d)
+  if err != nil {
+    s.errors++
+  }
+}
+
+type byDuration []time.Duration
+
+func (d byDuration) Len() int { return len(d) }
+func (d byDuration) Swap(i, j int) { d[i], d[j] = d[j], d[i] }
+func (d byDuration) Less(i, j int) bool { return d[i] < d[j] }
+
+func percentile(sorted []time.Duration, p int) time.Duration {
+  return sorted[(len(sorted) - 1) * p / 100]
+}
+
+func (r *recorder) report(elapsed time.Duration) {
+  r.Lock()
+  defer r.Unlock()
+
+  methods := []string{}
+  for method := range r.series {
+    methods = append(methods, method)
+  }
+  sort.Strings(methods)
+
+  if !*tsv {
+    fmt.Printf("%-18s %8s %8s %10s %10s %10s %10s %10s\n", "method", "calls", "errors", "per sec", "p50", "p90", "p99", "max")
+  }
+
+  for _, method := range methods {
+    s := r.series[method]
+    sort.Sort(byDuration(s.durations))
+    perSecond := float64(len(s.durations)) / elapsed.Seconds()
+    p50, p90, p99, max := percentile(s.durations, 50), percentile(s.durations, 90), percentile(s.durations, 99), s.durations[len(s.durations) - 1]
+
+    if *tsv {
+      fmt.Printf("%s\t%d\t%d\t%.1f\t%g\t%g\t%g\t%g\n", method, len(s.durations), s.errors, perSecond, p50.Seconds(), p90.Seconds(), p99.Seconds(), max.Seconds())
+    } else {
+      fmt.Printf("%-18s %8d %8d %10.1f %10s %10s %10s %10s\n", method, len(s.durations), s.errors, perSecond, p50, p90, p99, max)
+    }
+  }
+}
+
+type loadgen struct {
+  client runtime.RuntimeServiceClient
+  recorder *recorder
+}
+
+// call times f as an RPC of method
+func (l *loadgen) call(method string, f func(ctx context.Context) error) error {
+  ctx, cancel := context.WithTimeout(context.Background(), *timeout)
+  defer cancel()
+
+  start := time.Now()
+  err := f(ctx)
+  l.recorder.observe(method, time.Since(start), err)
+  return err
+}
+
+// lifecycle runs pod i through its lifecycle, and removes whatever was
+// created, even if a step failed
+func (l *loadgen) lifecycle(i int) error {
+  name := fmt.Sprintf("%s-%d", *prefix, i)
+  config := &runtime.PodSandboxConfig{
+    Metadata: &runtime.PodSandboxMetadata{
+      Name: name,
+      Uid: name,
+      Namespace: *prefix,
+    },
+    Hostname: name,
+  }
+
+  var podSandboxID string
+  err := l.call("RunPodSandbox", func(ctx context.Context) error {
+    resp, err := l.client.RunPodSandbox(ctx, &runtime.RunPodSandboxRequest{Config: config})
+    if err == nil {
+      podSandboxID = resp.PodSandboxId
+    }
+    return err
+  })
+  if err != nil {
+    return err
+  }
+
+  containerIDs := []string{}
+  for j := 0; j < *containers; j++ {
+    var containerID string
+    err = l.call("CreateContainer", func(ctx context.Context) error {
+      resp, err := l.client.CreateContainer(ctx, &runtime.CreateContainerRequest{
+        PodSandboxId: podSandboxID,
+        Config: &runtime.ContainerConfig{
+          Metadata: &runtime.ContainerMetadata{Name: fmt.Sprintf("c%d", j)},
+          Image: &runtime.ImageSpec{Image: *image},
+        },
+        SandboxConfig: config,
+      })
+      if err == nil {
+        containerID = resp.ContainerId
+      }
+      return err
+    })
+    if err != nil {
+      break
+    }
+    containerIDs = append(containerIDs, containerID)
+
+    err = l.call("StartContainer", func(ctx context.Context) error {
+      _, err := l.client.StartContainer(ctx, &runtime.StartContainerRequest{ContainerId: containerID})
+      return err
+    })
+    if err != nil {
+      break
+    }
+  }
+
+  if err == nil {
+    time.Sleep(*hold)
+  }
+
+  for _, containerID := range containerIDs {
+    l.call("StopContainer", func(ctx context.Context) error {
+      _, err := l.client.StopContainer(ctx, &runtime.StopContainerRequest{ContainerId: containerID})
+      return err
+    })
+    l.call("RemoveContainer", func(ctx context.Context) error {
+      _, err := l.client.RemoveContainer(ctx, &runtime.RemoveContainerRequest{ContainerId: containerID})
+      return err
+    })
+  }
+
+  l.call("StopPodSandbox", func(ctx context.Context) error {
+    _, err := l.client.StopPodSandbox(ctx, &runtime.StopPodSandboxRequest{PodSandboxId: podSandboxID})
+    return err
+  })
+  if e := l.call("RemovePodSandbox", func(ctx context.Context) error {
+    _, err := l.client.RemovePodSandbox(ctx, &runtime.RemovePodSandboxRequest{PodSandboxId: podSandboxID})
+    return err
+  }); err == nil {
+    err = e
+  }
+  return err
+}
+
+// list calls ListContainers every listInterval until done is closed
+func (l *loadgen) list(done chan struct{}) {
+  ticker := time.NewTicker(*listInterval)
+  defer ticker.Stop()
+
+  for {
+    l.call("ListContainers", func(ctx context.Context) error {
+      _, err := l.client.ListContainers(ctx, &runtime.ListContainersRequest{})
+      return err
+    })
+
+    select {
+    case <-done:
+      return
+    case <-ticker.C:
+    }
+  }
+}
+
+func run() error {
+  conn, err := grpc.Dial(*endpoint, grpc.WithInsecure(), grpc.WithTimeout(*timeout), grpc.WithDialer(func(addr string, timeout time.Duration) (net.Conn, error) {
+    return net.DialTimeout("unix", addr, timeout)
+  }))
+  if err != nil {
+    return err
+  }
+  defer conn.Close()
+
+  l := &loadgen{
+    client: runtime.NewRuntimeServiceClient(conn),
+    recorder: &recorder{series: make(map[string]*series)},
+  }
+
+  done := make(chan struct{})
+  var listing sync.WaitGroup
+  for i := 0; i < *listers; i++ {
+    listing.Add(1)
+    go func() {
+      defer listing.Done()
+      l.list(done)
+    }()
+  }
+
+  // pods are started at rate, by the first of workers free
+  next := make(chan int)
+  go func() {
+    var tick <-chan time.Time
+    if *rate > 0 {
+      ticker := time.NewTicker(time.Duration(float64(time.Second) / *rate))
+      defer ticker.Stop()
+      tick = ticker.C
+    }
+    for i := 0; i < *pods; i++ {
+      if tick != nil {
+        <-tick
+      }
+      next <- i
+    }
+    close(next)
+  }()
+
+  start := time.Now()
+  var failed int
+  var mu sync.Mutex
+  var working sync.WaitGroup
+  for w := 0; w < *concurrency; w++ {
+    working.Add(1)
+    go func() {
+      defer working.Done()
+      for i := range next {
+        if err := l.lifecycle(i); err != nil {
+          mu.Lock()
+          failed++
+          mu.Unlock()
+          fmt.Fprintf(os.Stderr, "pod %d: %v\n", i, err)
+        }
+      }
+    }()
+  }
+
+  working.Wait()
+  elapsed := time.Since(start)
+  close(done)
+  listing.Wait()
+
+  l.recorder.report(elapsed)
+  if !*tsv {
+    fmt.Printf("%d pods, %d failed, in %s, %.1f pods/s\n", *pods, failed, elapsed, float64(*pods) / elapsed.Seconds())
+  }
+  if failed > 0 {
+    return fmt.Errorf("%d of %d pods failed", failed, *pods)
+  }
+  return nil
+}
+
+func main() {
+  flag.Parse()
+
+  if err := run(); err != nil {
+    fmt.Fprintln(os.Stderr, "loadgen failed: ", err)
+    os.Exit(1)
+  }
+}
@@ -0,0 +1,47 @@
+package service
+
+import (
+  "fmt"
+  "path/filepath"
+
+  "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+)
+
+// CgroupArgs returns unspawn options to start container in its own
+// cgroup under root/node/pod, with limits set from resources of its
+// config. Usage of the container can be read from the cgroup, e.g.
+// cpu.stat and memory.current.
+func CgroupArgs(root string, node string, podSandboxID string, containerID string, resources *runtime.LinuxContainerResources, pidsMax int64) []string {
+  arg := []string{"--cgroup=" + filepath.Join(root, node, podSandboxID, containerID)}
+
+  if resources != nil {
+    if resources.CpuQuota > 0 {
+      period := resources.CpuPeriod
+      if period <= 0 {
+        period = 100000
+      }
+      arg = append(arg, fmt.Sprintf("--cpu-max=%d %d", resources.CpuQuota, period))
+    }
+
+    // same conversion from cpu.shares to cpu.weight as runc
+    if resources.CpuShares > 0 {
+      shares := resources.CpuShares
+      if shares < 2 {
+        shares = 2
+      } else if shares > 262144 {
+        shares = 262144
+      }
+      arg = append(arg, fmt.Sprintf("--cpu-weight=%d", 1 + ((shares - 2) * 9999) / 262142))
+    }
+
+    if resources.MemoryLimitInBytes > 0 {
+      arg = append(arg, fmt.Sprintf("--memory-max=%d", resources.MemoryLimitInBytes))
+    }
+  }
+
+  if pidsMax > 0 {
+    arg = append(arg, fmt.Sprintf("--pids-max=%d", pidsMax))
+  }
+
+  return arg
+}
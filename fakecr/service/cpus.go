@@ -0,0 +1,320 @@
+package service
+
+import (
+  "fmt"
+  "io/ioutil"
+  "path/filepath"
+  "sort"
+  "strconv"
+  "strings"
+  "sync"
+
+  "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+)
+
+const sysCpuDir = "/sys/devices/system/cpu"
+
+type Cpu struct {
+  Id int
+  // first CPU of the core, i.e. of thread_siblings_list
+  Core int
+  Node int
+}
+
+type byTopology []Cpu
+
+func (c byTopology) Len() int      { return len(c) }
+func (c byTopology) Swap(i, j int) { c[i], c[j] = c[j], c[i] }
+func (c byTopology) Less(i, j int) bool {
+  if c[i].Node != c[j].Node {
+    return c[i].Node < c[j].Node
+  }
+  if c[i].Core != c[j].Core {
+    return c[i].Core < c[j].Core
+  }
+  return c[i].Id < c[j].Id
+}
+
+// CpuAllocator hands out CPUs of a pool exclusively to containers of
+// Guaranteed pods, whole cores first, from one NUMA node if possible.
+// Other containers run on CPUs outside of the pool, so that they
+// never share a core with an exclusive container.
+type CpuAllocator struct {
+  // guards Owner, containers are started and reaped concurrently
+  sync.Mutex
+  Cpus []Cpu
+  Owner map[int]string
+  Shared string
+}
+
+// ParseCpuList parses list like 0-3,8 as in cpuset.cpus
+func ParseCpuList(list string) ([]int, error) {
+  result := []int{}
+  list = strings.TrimSpace(list)
+  if list == "" {
+    return result, nil
+  }
+
+  for _, r := range strings.Split(list, ",") {
+    bounds := strings.SplitN(r, "-", 2)
+    first, err := strconv.Atoi(bounds[0])
+    if err != nil {
+      return nil, fmt.Errorf("invalid cpu list %q", list)
+    }
+
+    last := first
+    if len(bounds) == 2 {
+      if last, err = strconv.Atoi(bounds[1]); err != nil {
+        return nil, fmt.Errorf("invalid cpu list %q", list)
+      }
+    }
+
+    for i := first; i <= last; i++ {
+      result = append(result, i)
+    }
+  }
+
+  return result, nil
+}
+
+// FormatCpuList formats sorted ids as list like 0-3,8
+func FormatCpuList(ids []int) string {
+  ranges := []string{}
+  for i := 0; i < len(ids); {
+    j := i
+    for j + 1 < len(ids) && ids[j + 1] == ids[j] + 1 {
+      j++
+    }
+
+    if i == j {
+      ranges = append(ranges, strconv.Itoa(ids[i]))
+    } else {
+      ranges = append(ranges, fmt.Sprintf("%d-%d", ids[i], ids[j]))
+    }
+    i = j + 1
+  }
+  return strings.Join(ranges, ",")
+}
+
+func readCpuList(path string) ([]int, error) {
+  data, err := ioutil.ReadFile(path)
+  if err != nil {
+    return nil, err
+  }
+  return ParseCpuList(string(data))
+}
+
+func NewCpuAllocator(list string) (*CpuAllocator, error) {
+  pool, err := ParseCpuList(list)
+  if err != nil {
+    return nil, err
+  }
+
+  online, err := readCpuList(filepath.Join(sysCpuDir, "online"))
+  if err != nil {
+    return nil, err
+  }
+
+  a := &CpuAllocator{
+    Owner: make(map[int]string),
+  }
+
+  inPool := make(map[int]bool)
+  for _, id := range pool {
+    siblings, err := readCpuList(filepath.Join(sysCpuDir, fmt.Sprintf("cpu%d", id), "topology", "thread_siblings_list"))
+    if err != nil {
+      return nil, err
+    }
+
+    cpu := Cpu{Id: id, Core: id}
+    if len(siblings) > 0 {
+      cpu.Core = siblings[0]
+    }
+
+    nodes, _ := filepath.Glob(filepath.Join(sysCpuDir, fmt.Sprintf("cpu%d", id), "node*"))
+    if len(nodes) > 0 {
+      cpu.Node, _ = strconv.Atoi(strings.TrimPrefix(filepath.Base(nodes[0]), "node"))
+    }
+
+    a.Cpus = append(a.Cpus, cpu)
+    inPool[id] = true
+  }
+
+  sort.Sort(byTopology(a.Cpus))
+
+  shared := []int{}
+  for _, id := range online {
+    if !inPool[id] {
+      shared = append(shared, id)
+    }
+  }
+  if len(shared) == 0 {
+    return nil, fmt.Errorf("no cpu left for shared pool")
+  }
+  a.Shared = FormatCpuList(shared)
+
+  return a, nil
+}
+
+// ExclusiveCpus returns the number of CPUs for container to run on
+// exclusively, when its cpu limit is a whole number of CPUs and its
+// cpu request equals to its limit, 0 otherwise. CRI passes neither
+// QoS class nor memory request, so a memory limit is taken as the
+// sign of a Guaranteed pod.
+func ExclusiveCpus(resources *runtime.LinuxContainerResources) int {
+  if resources == nil || resources.CpuQuota <= 0 || resources.CpuPeriod <= 0 || resources.MemoryLimitInBytes <= 0 {
+    return 0
+  }
+
+  if resources.CpuQuota % resources.CpuPeriod != 0 {
+    return 0
+  }
+
+  n := resources.CpuQuota / resources.CpuPeriod
+  if resources.CpuShares != n * 1024 {
+    return 0
+  }
+  return int(n)
+}
+
+// take picks n free CPUs among cpus, whole free cores first
+func (a *CpuAllocator) take(cpus []Cpu, n int) []int {
+  cores := make(map[int][]int)
+  busy := make(map[int]bool)
+  for _, cpu := range cpus {
+    if _, ok := a.Owner[cpu.Id]; ok {
+      busy[cpu.Core] = true
+    } else {
+      cores[cpu.Core] = append(cores[cpu.Core], cpu.Id)
+    }
+  }
+
+  result := []int{}
+  taken := make(map[int]bool)
+  for _, cpu := range cpus {
+    ids, ok := cores[cpu.Core]
+    if !ok || busy[cpu.Core] || taken[cpu.Core] || len(ids) > n - len(result) {
+      continue
+    }
+    result = append(result, ids...)
+    taken[cpu.Core] = true
+  }
+
+  // remaining CPUs from cores already in use, to keep free cores whole
+  for _, pass := range []bool{true, false} {
+    for _, cpu := range cpus {
+      if len(result) == n {
+        return result
+      }
+      if _, ok := a.Owner[cpu.Id]; ok || taken[cpu.Core] || busy[cpu.Core] != pass {
+        continue
+      }
+      result = append(result, cpu.Id)
+    }
+  }
+
+  return result
+}
+
+// Allocate assigns n CPUs to container, and returns them along with
+// their NUMA nodes
+func (a *CpuAllocator) Allocate(containerID string, n int) ([]int, []int, error) {
+  a.Lock()
+  defer a.Unlock()
+
+  free := make(map[int]int)
+  for _, cpu := range a.Cpus {
+    if _, ok := a.Owner[cpu.Id]; !ok {
+      free[cpu.Node]++
+    }
+  }
+
+  // the node with fewest free CPUs that fits, across nodes if none
+  node := -1
+  for i, count := range free {
+    if count >= n && (node < 0 || count < free[node] || (count == free[node] && i < node)) {
+      node = i
+    }
+  }
+
+  cpus := a.Cpus
+  if node >= 0 {
+    cpus = []Cpu{}
+    for _, cpu := range a.Cpus {
+      if cpu.Node == node {
+        cpus = append(cpus, cpu)
+      }
+    }
+  }
+
+  ids := a.take(cpus, n)
+  if len(ids) < n {
+    return nil, nil, fmt.Errorf("not enough exclusive cpus for %s, %d requested", containerID, n)
+  }
+  sort.Ints(ids)
+
+  for _, id := range ids {
+    a.Owner[id] = containerID
+  }
+
+  // a.Cpus is sorted by node
+  nodes := []int{}
+  for _, cpu := range a.Cpus {
+    if a.Owner[cpu.Id] == containerID && (len(nodes) == 0 || nodes[len(nodes) - 1] != cpu.Node) {
+      nodes = append(nodes, cpu.Node)
+    }
+  }
+  return ids, nodes, nil
+}
+
+// Release returns CPUs of container to the pool
+func (a *CpuAllocator) Release(containerID string) {
+  a.Lock()
+  defer a.Unlock()
+
+  for id, owner := range a.Owner {
+    if owner == containerID {
+      delete(a.Owner, id)
+    }
+  }
+}
+
+// Owned returns CPUs assigned to container
+func (a *CpuAllocator) Owned(containerID string) []int {
+  a.Lock()
+  defer a.Unlock()
+
+  ids := []int{}
+  for _, cpu := range a.Cpus {
+    if a.Owner[cpu.Id] == containerID {
+      ids = append(ids, cpu.Id)
+    }
+  }
+  return ids
+}
+
+// Claim assigns CPUs to container again, when recovering state
+func (a *CpuAllocator) Claim(containerID string, ids []int) {
+  a.Lock()
+  defer a.Unlock()
+
+  for _, id := range ids {
+    a.Owner[id] = containerID
+  }
+}
+
+// CpuArgs returns unspawn options to place container, on exclusive
+// CPUs and their NUMA nodes for Guaranteed pods, or on shared pool
+func (a *CpuAllocator) CpuArgs(containerID string, resources *runtime.LinuxContainerResources) ([]string, error) {
+  n := ExclusiveCpus(resources)
+  if n == 0 {
+    return []string{"--cpus=" + a.Shared}, nil
+  }
+
+  ids, nodes, err := a.Allocate(containerID, n)
+  if err != nil {
+    return nil, err
+  }
+
+  return []string{"--cpus=" + FormatCpuList(ids), "--mempolicy=bind:" + FormatCpuList(nodes)}, nil
+}
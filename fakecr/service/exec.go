@@ -0,0 +1,268 @@
+package service
+
+import (
+  "bytes"
+  "errors"
+  "fmt"
+  "hash/fnv"
+  "io"
+  "net"
+  "os"
+  "os/exec"
+  "path/filepath"
+  "strconv"
+  "strings"
+  "syscall"
+  "time"
+
+  "golang.org/x/net/context"
+  "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+)
+
+// upper bound of each of stdout and stderr kept by ExecSync, the rest
+// is discarded, so that a chatty probe cannot exhaust memory
+const maxExecSyncOutput = 1024 * 1024
+
+// not embedding bytes.Buffer, as io.Copy would bypass Write with its
+// ReadFrom
+type boundedBuffer struct {
+  buf bytes.Buffer
+  limit int
+}
+
+// Write never fails, so the command is not blocked on a full pipe
+func (b *boundedBuffer) Write(p []byte) (int, error) {
+  n := len(p)
+  if room := b.limit - b.buf.Len(); room < n {
+    p = p[:room]
+  }
+  b.buf.Write(p)
+  return n, nil
+}
+
+func (b *boundedBuffer) Bytes() []byte {
+  return b.buf.Bytes()
+}
+
+// errNoHelper is returned when exec helper of container is not
+// listening, e.g. not started yet
+var errNoHelper = errors.New("exec helper not available")
+
+// ExecSocket returns socket of exec helper of container, named after
+// hash of container id, as the id is too long for a socket path
+func (s *FakeRuntimeService) ExecSocket(containerID string) string {
+  h := fnv.New64a()
+  h.Write([]byte(containerID))
+  return filepath.Join("/run/containers", *s.Node, "exec", fmt.Sprintf("%016x.sock", h.Sum64()))
+}
+
+// runDir returns directory of pidfile of container, if it is running
+func (s *FakeRuntimeService) runDir(containerID string, cmd []string) (string, error) {
+  c, ok := s.State.Container(containerID)
+  if !ok {
+    return "", fmt.Errorf("container %s not found", containerID)
+  }
+
+  if c.State != runtime.ContainerState_CONTAINER_RUNNING {
+    return "", fmt.Errorf("container %s not running", containerID)
+  }
+
+  if len(cmd) == 0 {
+    return "", fmt.Errorf("empty command")
+  }
+
+  return filepath.Join("/run/containers", *s.Node, c.SandboxID), nil
+}
+
+// ExecCommand returns command to run cmd in container with unenter.
+// The command is started in its own process group, so that it can be
+// killed along with its children.
+func (s *FakeRuntimeService) ExecCommand(containerID string, cmd []string) (*exec.Cmd, error) {
+  runDir, err := s.runDir(containerID, cmd)
+  if err != nil {
+    return nil, err
+  }
+
+  arg := []string{"--pidfile=" + filepath.Join(runDir, containerID + ".pid"), "--context=" + filepath.Join(runDir, containerID + ".context")}
+  if *s.Registry != "" {
+    arg = append(arg, "--registry=" + *s.Registry)
+  }
+  arg = append(arg, "--")
+  arg = append(arg, cmd...)
+
+  command := exec.Command(filepath.Join(*s.BinDir, "unenter"), arg...)
+  command.SysProcAttr = &syscall.SysProcAttr{Setpgid: true}
+  return command, nil
+}
+
+func killGroup(command *exec.Cmd) {
+  syscall.Kill(-command.Process.Pid, syscall.SIGKILL)
+}
+
+// execHelper asks exec helper listening on socket to run cmd, same as
+// `unexec --connect=socket cmd...`, without forking a client. The
+// helper kills the command once the connection is closed, when
+// timeout in seconds is reached, or ctx is done.
+func execHelper(ctx context.Context, socket string, cmd []string, timeout int64) (*runtime.ExecSyncResponse, error) {
+  conn, err := net.DialUnix("unixpacket", nil, &net.UnixAddr{Name: socket, Net: "unixpacket"})
+  if err != nil {
+    return nil, errNoHelper
+  }
+  defer conn.Close()
+
+  stdin, err := os.Open(os.DevNull)
+  if err != nil {
+    return nil, err
+  }
+  defer stdin.Close()
+
+  outr, outw, err := os.Pipe()
+  if err != nil {
+    return nil, err
+  }
+  defer outr.Close()
+
+  errr, errw, err := os.Pipe()
+  if err != nil {
+    outw.Close()
+    return nil, err
+  }
+  defer errr.Close()
+
+  payload := []byte(strings.Join(cmd, "\x00") + "\x00")
+  rights := syscall.UnixRights(int(stdin.Fd()), int(outw.Fd()), int(errw.Fd()))
+
+  _, _, err = conn.WriteMsgUnix(payload, rights, nil)
+  outw.Close()
+  errw.Close()
+  if err != nil {
+    return nil, err
+  }
+
+  reply := make([]byte, 16)
+  n, err := conn.Read(reply)
+  if err != nil {
+    return nil, err
+  }
+
+  if pid, err := strconv.Atoi(string(reply[:n])); err != nil || pid < 0 {
+    return nil, fmt.Errorf("exec helper failed to run %q", cmd)
+  }
+
+  stdout := &boundedBuffer{limit: maxExecSyncOutput}
+  stderr := &boundedBuffer{limit: maxExecSyncOutput}
+  var exitCode int32
+
+  done := make(chan error, 3)
+  go func() {
+    _, err := io.Copy(stdout, outr)
+    done <- err
+  }()
+  go func() {
+    _, err := io.Copy(stderr, errr)
+    done <- err
+  }()
+  go func() {
+    n, err := conn.Read(reply)
+    if err == nil {
+      var code int
+      code, err = strconv.Atoi(string(reply[:n]))
+      exitCode = int32(code)
+    }
+    done <- err
+  }()
+
+  var expired <-chan time.Time
+  if timeout > 0 {
+    timer := time.NewTimer(time.Duration(timeout) * time.Second)
+    defer timer.Stop()
+    expired = timer.C
+  }
+
+  for i := 0; i < 3; i++ {
+    select {
+    case err := <-done:
+      if err != nil {
+        return nil, err
+      }
+    case <-expired:
+      return nil, fmt.Errorf("command %q timed out after %ds", cmd, timeout)
+    case <-ctx.Done():
+      return nil, ctx.Err()
+    }
+  }
+
+  return &runtime.ExecSyncResponse {
+    Stdout: stdout.Bytes(),
+    Stderr: stderr.Bytes(),
+    ExitCode: exitCode,
+  }, nil
+}
+
+// execSync runs cmd in container, and kills it when timeout in seconds
+// is reached, or ctx is done. The exec helper of container is used if
+// it is listening, unenter otherwise.
+func (s *FakeRuntimeService) execSync(ctx context.Context, containerID string, cmd []string, timeout int64) (*runtime.ExecSyncResponse, error) {
+  if s.ExecHelper {
+    if _, err := s.runDir(containerID, cmd); err != nil {
+      return nil, err
+    }
+
+    if resp, err := execHelper(ctx, s.ExecSocket(containerID), cmd, timeout); err != errNoHelper {
+      return resp, err
+    }
+  }
+
+  command, err := s.ExecCommand(containerID, cmd)
+  if err != nil {
+    return nil, err
+  }
+
+  stdout := &boundedBuffer{limit: maxExecSyncOutput}
+  stderr := &boundedBuffer{limit: maxExecSyncOutput}
+  command.Stdout = stdout
+  command.Stderr = stderr
+
+  if err := command.Start(); err != nil {
+    return nil, err
+  }
+
+  done := make(chan error, 1)
+  go func() {
+    done <- command.Wait()
+  }()
+
+  var expired <-chan time.Time
+  if timeout > 0 {
+    timer := time.NewTimer(time.Duration(timeout) * time.Second)
+    defer timer.Stop()
+    expired = timer.C
+  }
+
+  select {
+  case err = <-done:
+  case <-expired:
+    killGroup(command)
+    <-done
+    return nil, fmt.Errorf("command %q timed out after %ds", cmd, timeout)
+  case <-ctx.Done():
+    killGroup(command)
+    <-done
+    return nil, ctx.Err()
+  }
+
+  var exitCode int32
+  if err != nil {
+    exitErr, ok := err.(*exec.ExitError)
+    if !ok {
+      return nil, err
+    }
+    exitCode = int32(exitErr.Sys().(syscall.WaitStatus).ExitStatus())
+  }
+
+  return &runtime.ExecSyncResponse {
+    Stdout: stdout.Bytes(),
+    Stderr: stderr.Bytes(),
+    ExitCode: exitCode,
+  }, nil
+}
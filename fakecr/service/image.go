@@ -25,25 +25,47 @@ import (
   "path/filepath"
   "strings"
   "sync"
+  "sync/atomic"
 
-  "github.com/golang/glog"
   "golang.org/x/net/context"
   "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
   "k8s.io/kubernetes/pkg/kubelet/util/sliceutils"
 )
 
 type FakeImageService struct {
+  // serializes writers of Images
   sync.Mutex
 
   RootDir *string
-  Images map[string]*runtime.Image
+  // map[string]*runtime.Image, replaced by writers with a changed
+  // copy, so that readers never lock
+  Images atomic.Value
 }
 
 func NewFakeImageService(rootdir *string) *FakeImageService {
-  return &FakeImageService{
+  s := &FakeImageService{
     RootDir: rootdir,
-    Images: make(map[string]*runtime.Image),
   }
+  s.Images.Store(make(map[string]*runtime.Image))
+  return s
+}
+
+func (s *FakeImageService) images() map[string]*runtime.Image {
+  return s.Images.Load().(map[string]*runtime.Image)
+}
+
+// update publishes a copy of images changed by f
+func (s *FakeImageService) update(f func(images map[string]*runtime.Image)) {
+  s.Lock()
+  defer s.Unlock()
+
+  old := s.images()
+  images := make(map[string]*runtime.Image, len(old) + 1)
+  for name, img := range old {
+    images[name] = img
+  }
+  f(images)
+  s.Images.Store(images)
 }
 
 func (s *FakeImageService) makeFakeImage(id string) *runtime.Image {
@@ -55,13 +77,10 @@ func (s *FakeImageService) makeFakeImage(id string) *runtime.Image {
 }
 
 func (s *FakeImageService) ListImages(ctx context.Context, req *runtime.ListImagesRequest) (*runtime.ListImagesResponse, error) {
-  glog.Infof("ListImages %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   filter := req.Filter;
   images := make([]*runtime.Image, 0)
-  for _, img := range s.Images {
+  for _, img := range s.images() {
     if filter != nil && filter.Image != nil {
       if !sliceutils.StringInSlice(filter.Image.Image, img.RepoTags) {
         continue
@@ -76,33 +95,29 @@ func (s *FakeImageService) ListImages(ctx context.Context, req *runtime.ListImag
 
 
 func (s *FakeImageService) ImageStatus(ctx context.Context, req *runtime.ImageStatusRequest) (*runtime.ImageStatusResponse, error) {
-  glog.Infof("ImageStatus %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   return &runtime.ImageStatusResponse {
-    Image: s.Images[req.Image.Image],
+    Image: s.images()[req.Image.Image],
   }, nil
 }
 
 func (s *FakeImageService) PullImage(ctx context.Context, req *runtime.PullImageRequest) (*runtime.PullImageResponse, error) {
-  glog.Infof("PullImage %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   image := req.Image;
 
   imageID := image.Image
   name := strings.SplitN(imageID, ":", 2)[0]
 
-  if _, ok := s.Images[name]; !ok {
+  if _, ok := s.images()[name]; !ok {
 
     path := filepath.Join(*s.RootDir, "images", name)
     if _, err := os.Stat(path); err != nil {
        return nil, fmt.Errorf("image not exists %s", path)
     }
 
-    s.Images[name] = s.makeFakeImage(name)
+    s.update(func(images map[string]*runtime.Image) {
+      images[name] = s.makeFakeImage(name)
+    })
   }
 
   return &runtime.PullImageResponse {
@@ -111,11 +126,10 @@ func (s *FakeImageService) PullImage(ctx context.Context, req *runtime.PullImage
 }
 
 func (s *FakeImageService) RemoveImage(ctx context.Context, req *runtime.RemoveImageRequest) (*runtime.RemoveImageResponse, error) {
-  glog.Infof("RemoveImage %s", req.String())
-  s.Lock()
-  defer s.Unlock()
   image := req.Image
-  delete(s.Images, image.Image)
+  s.update(func(images map[string]*runtime.Image) {
+    delete(images, image.Image)
+  })
   return &runtime.RemoveImageResponse {
   }, nil
 }
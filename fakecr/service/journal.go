@@ -0,0 +1,291 @@
+package service
+
+import (
+  "bufio"
+  "bytes"
+  "encoding/json"
+  "io/ioutil"
+  "os"
+  "path/filepath"
+  "sync"
+  "time"
+
+  "github.com/golang/glog"
+  "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+)
+
+// record of the journal, one change of State, as a JSON line
+type record struct {
+  Sandbox *FakePodSandbox `json:",omitempty"`
+  Container *FakeContainer `json:",omitempty"`
+  RemoveSandbox string `json:",omitempty"`
+  RemoveContainer string `json:",omitempty"`
+}
+
+// Journal appends changes of State to a file, so that they can be
+// replayed when fakecr restarts. Records appended meanwhile are
+// written and synced together, and changes wait for them to be synced
+// before their RPCs return. Once Compact records are written, the file
+// is replaced by a snapshot of State.
+type Journal struct {
+  Path string
+  Compact int
+  State *State
+
+  sync.Mutex
+  cond *sync.Cond
+  file *os.File
+  pending []record
+  // number of records appended, and synced
+  seq uint64
+  synced uint64
+  // number of records in file
+  written int
+}
+
+// interval between two attempts to compact, after records failed to
+// be written
+const journalRetry = time.Second
+
+// ReadJournal returns records of journal at path, up to the first
+// one not complete, e.g. being written when fakecr crashed
+func ReadJournal(path string) ([]record, error) {
+  data, err := ioutil.ReadFile(path)
+  if os.IsNotExist(err) {
+    return nil, nil
+  }
+  if err != nil {
+    return nil, err
+  }
+
+  records := []record{}
+  for _, line := range bytes.Split(data, []byte("\n")) {
+    var rec record
+    if err := json.Unmarshal(line, &rec); err != nil {
+      break
+    }
+    records = append(records, rec)
+  }
+  return records, nil
+}
+
+func (st *State) replay(records []record) {
+  for _, rec := range records {
+    switch {
+    case rec.Sandbox != nil:
+      st.PutSandbox(rec.Sandbox)
+    case rec.Container != nil:
+      st.PutContainer(rec.Container)
+    case rec.RemoveSandbox != "":
+      st.DeleteSandbox(rec.RemoveSandbox)
+    case rec.RemoveContainer != "":
+      st.DeleteContainer(rec.RemoveContainer)
+    }
+  }
+}
+
+// OpenJournal starts journal at path with a snapshot of state, and
+// attaches it to state
+func OpenJournal(path string, compact int, state *State) (*Journal, error) {
+  j := &Journal{
+    Path: path,
+    Compact: compact,
+    State: state,
+  }
+  j.cond = sync.NewCond(&j.Mutex)
+
+  if err := os.MkdirAll(filepath.Dir(path), 0700); err != nil {
+    return nil, err
+  }
+
+  if err := j.compact(); err != nil {
+    return nil, err
+  }
+
+  state.Journal = j
+  return j, nil
+}
+
+// Append queues records, and returns the sequence number to Wait for
+func (j *Journal) Append(records []record) uint64 {
+  if j == nil || len(records) == 0 {
+    return 0
+  }
+
+  j.Lock()
+  defer j.Unlock()
+  j.pending = append(j.pending, records...)
+  j.seq += uint64(len(records))
+  j.cond.Broadcast()
+  return j.seq
+}
+
+// Wait returns once records up to seq are synced
+func (j *Journal) Wait(seq uint64) {
+  if j == nil {
+    return
+  }
+
+  j.Lock()
+  defer j.Unlock()
+  for j.synced < seq {
+    j.cond.Wait()
+  }
+}
+
+func writeRecords(w *bufio.Writer, records []record) error {
+  for _, rec := range records {
+    data, err := json.Marshal(&rec)
+    if err != nil {
+      return err
+    }
+    w.Write(data)
+    if err := w.WriteByte('\n'); err != nil {
+      return err
+    }
+  }
+  return w.Flush()
+}
+
+// compact replaces the file with a snapshot of State. Records still
+// pending may already be in the snapshot, replaying them again later
+// does no harm, as each is the latest of its sandbox or container.
+func (j *Journal) compact() error {
+  records := []record{}
+  for _, sb := range j.State.Sandboxes() {
+    records = append(records, record{Sandbox: sb})
+  }
+  for _, c := range j.State.Containers() {
+    records = append(records, record{Container: c})
+  }
+
+  tmp := j.Path + ".tmp"
+  file, err := os.OpenFile(tmp, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+  if err != nil {
+    return err
+  }
+
+  if err := writeRecords(bufio.NewWriter(file), records); err != nil {
+    file.Close()
+    return err
+  }
+
+  if err := file.Sync(); err != nil {
+    file.Close()
+    return err
+  }
+  file.Close()
+
+  if err := os.Rename(tmp, j.Path); err != nil {
+    return err
+  }
+
+  if dir, err := os.Open(filepath.Dir(j.Path)); err == nil {
+    dir.Sync()
+    dir.Close()
+  }
+
+  file, err = os.OpenFile(j.Path, os.O_WRONLY|os.O_APPEND, 0600)
+  if err != nil {
+    return err
+  }
+
+  if j.file != nil {
+    j.file.Close()
+  }
+  j.file = file
+  j.written = len(records)
+  return nil
+}
+
+// Run writes and syncs pending records, as they are appended
+func (j *Journal) Run() {
+  w := bufio.NewWriter(j.file)
+
+  for {
+    j.Lock()
+    for len(j.pending) == 0 {
+      j.cond.Wait()
+    }
+    records := j.pending
+    seq := j.seq
+    j.pending = nil
+    j.Unlock()
+
+    err := writeRecords(w, records)
+    if err == nil {
+      err = j.file.Sync()
+    }
+
+    j.Lock()
+    j.written += len(records)
+    // a record partly written would end replay, rewrite the file
+    if err != nil {
+      glog.Errorf("write journal %s: %v", j.Path, err)
+      j.written = j.Compact
+    }
+    if j.written >= j.Compact {
+      // records not written are only durable once the snapshot is,
+      // their RPCs wait until then
+      for {
+        cerr := j.compact()
+        if cerr == nil || err == nil {
+          if cerr != nil {
+            glog.Errorf("compact journal %s: %v", j.Path, cerr)
+          }
+          break
+        }
+        glog.Errorf("compact journal %s: %v, retry in %s", j.Path, cerr, journalRetry)
+        j.Unlock()
+        time.Sleep(journalRetry)
+        j.Lock()
+      }
+      w = bufio.NewWriter(j.file)
+    }
+    j.synced = seq
+    j.cond.Broadcast()
+    j.Unlock()
+  }
+}
+
+// Recover replays journal at path, reconciles the state with what is
+// still alive on the node, and journals further changes. Containers
+// no longer running are marked exited, and sandboxes whose network
+// namespace is gone not ready, so that kubelet only recreates those.
+func (s *FakeRuntimeService) Recover(path string, compact int) error {
+  records, err := ReadJournal(path)
+  if err != nil {
+    return err
+  }
+  s.State.replay(records)
+
+  for _, sb := range s.State.Sandboxes() {
+    if sb.State != runtime.PodSandboxState_SANDBOX_READY {
+      continue
+    }
+    if _, err := os.Stat(filepath.Join("/var/run/netns", sb.Hostname)); err != nil {
+      s.State.UpdateSandbox(sb.Id, func(sb *FakePodSandbox) {
+        sb.State = runtime.PodSandboxState_SANDBOX_NOTREADY
+      })
+    }
+  }
+
+  s.CheckStates()
+
+  if s.Cpus != nil {
+    for _, c := range s.State.Containers() {
+      if c.State == runtime.ContainerState_CONTAINER_RUNNING {
+        s.Cpus.Claim(c.Id, c.ExclusiveCpus)
+      }
+    }
+  }
+
+  glog.Infof("recovered %d sandboxes and %d containers from %s", len(s.State.Sandboxes()), len(s.State.Containers()), path)
+
+  j, err := OpenJournal(path, compact, s.State)
+  if err != nil {
+    return err
+  }
+  go j.Run()
+  return nil
+}
@@ -0,0 +1,211 @@
+package service
+
+import (
+  "fmt"
+  "io"
+  "net/http"
+  "path"
+  "path/filepath"
+  "sort"
+  "strings"
+  "sync"
+  "time"
+
+  "github.com/golang/glog"
+  "golang.org/x/net/context"
+  "google.golang.org/grpc"
+)
+
+// upper bounds of latency buckets, in seconds
+var latencyBuckets = []float64{0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30}
+
+type histogram struct {
+  // counts[i] is the number of observations in bucket i, the last one
+  // is for those above all bounds
+  counts []uint64
+  sum float64
+  count uint64
+  errors uint64
+}
+
+func (h *histogram) observe(d time.Duration, err error) {
+  if h.counts == nil {
+    h.counts = make([]uint64, len(latencyBuckets) + 1)
+  }
+
+  seconds := d.Seconds()
+  i := sort.SearchFloat64s(latencyBuckets, seconds)
+  h.counts[i]++
+  h.sum += seconds
+  h.count++
+  if err != nil {
+    h.errors++
+  }
+}
+
+// Metrics counts RPCs and external commands, with their errors and
+// latencies, and phases of starting containers traced by unspawn,
+// served in Prometheus text format
+type Metrics struct {
+  sync.Mutex
+  requests map[string]*histogram
+  commands map[string]*histogram
+  phases map[string]*histogram
+}
+
+var metrics = &Metrics{
+  requests: make(map[string]*histogram),
+  commands: make(map[string]*histogram),
+  phases: make(map[string]*histogram),
+}
+
+// MetricsHandler serves metrics of fakecr
+func MetricsHandler() http.Handler {
+  return metrics
+}
+
+func (m *Metrics) observe(series map[string]*histogram, name string, d time.Duration, err error) {
+  m.Lock()
+  defer m.Unlock()
+
+  h, ok := series[name]
+  if !ok {
+    h = &histogram{}
+    series[name] = h
+  }
+  h.observe(d, err)
+}
+
+// commandName names command by its program and subcommand, e.g.
+// "pod create"
+func commandName(name string, arg []string) string {
+  name = filepath.Base(name)
+  if len(arg) > 0 && !strings.HasPrefix(arg[0], "-") {
+    name += " " + arg[0]
+  }
+  return name
+}
+
+func writeHistograms(w io.Writer, metric string, label string, series map[string]*histogram) {
+  names := []string{}
+  for name := range series {
+    names = append(names, name)
+  }
+  sort.Strings(names)
+
+  fmt.Fprintf(w, "# TYPE %s_total counter\n", metric)
+  for _, name := range names {
+    fmt.Fprintf(w, "%s_total{%s=%q} %d\n", metric, label, name, series[name].count)
+  }
+
+  fmt.Fprintf(w, "# TYPE %s_errors_total counter\n", metric)
+  for _, name := range names {
+    fmt.Fprintf(w, "%s_errors_total{%s=%q} %d\n", metric, label, name, series[name].errors)
+  }
+
+  fmt.Fprintf(w, "# TYPE %s_duration_seconds histogram\n", metric)
+  for _, name := range names {
+    h := series[name]
+    var cumulative uint64
+    for i, bound := range latencyBuckets {
+      cumulative += h.counts[i]
+      fmt.Fprintf(w, "%s_duration_seconds_bucket{%s=%q,le=\"%g\"} %d\n", metric, label, name, bound, cumulative)
+    }
+    fmt.Fprintf(w, "%s_duration_seconds_bucket{%s=%q,le=\"+Inf\"} %d\n", metric, label, name, h.count)
+    fmt.Fprintf(w, "%s_duration_seconds_sum{%s=%q} %g\n", metric, label, name, h.sum)
+    fmt.Fprintf(w, "%s_duration_seconds_count{%s=%q} %d\n", metric, label, name, h.count)
+  }
+}
+
+func (m *Metrics) ServeHTTP(w http.ResponseWriter, r *http.Request) {
+  w.Header().Set("Content-Type", "text/plain; version=0.0.4")
+
+  m.Lock()
+  defer m.Unlock()
+
+  writeHistograms(w, "fakecr_requests", "method", m.requests)
+  writeHistograms(w, "fakecr_commands", "command", m.commands)
+  writeHistograms(w, "fakecr_startup_phases", "phase", m.phases)
+}
+
+// lines of each key logged a second at most
+const logBurst = 10
+
+type logWindow struct {
+  start time.Time
+  logged int
+  suppressed int
+}
+
+// logLimiter lets through logBurst lines per key a second, and counts
+// the lines suppressed beyond that
+type logLimiter struct {
+  sync.Mutex
+  windows map[string]*logWindow
+}
+
+var limiter = &logLimiter{
+  windows: make(map[string]*logWindow),
+}
+
+// allow returns whether a line of key may be logged, and how many were
+// suppressed before it
+func (l *logLimiter) allow(key string) (bool, int) {
+  l.Lock()
+  defer l.Unlock()
+
+  now := time.Now()
+  w, ok := l.windows[key]
+  if !ok {
+    w = &logWindow{}
+    l.windows[key] = w
+  }
+
+  if now.Sub(w.start) >= time.Second {
+    w.start = now
+    w.logged = 0
+  }
+
+  if w.logged >= logBurst {
+    w.suppressed++
+    return false, 0
+  }
+
+  n := w.suppressed
+  w.logged++
+  w.suppressed = 0
+  return true, n
+}
+
+// level of request logs of method, frequent reads by kubelet are only
+// logged at a higher one
+func requestLevel(method string) glog.Level {
+  if strings.HasPrefix(method, "List") || strings.HasSuffix(method, "Status") || method == "Version" {
+    return 4
+  }
+  return 2
+}
+
+// Interceptor records metrics of each RPC, and logs it if -v is at
+// least its level, or if it failed. Requests are formatted only when
+// logged, at most logBurst times a second per method.
+func Interceptor(ctx context.Context, req interface{}, info *grpc.UnaryServerInfo, handler grpc.UnaryHandler) (interface{}, error) {
+  start := time.Now()
+  resp, err := handler(ctx, req)
+  d := time.Since(start)
+
+  method := path.Base(info.FullMethod)
+  metrics.observe(metrics.requests, method, d, err)
+
+  if err != nil {
+    if ok, suppressed := limiter.allow(method + " error"); ok {
+      glog.Errorf("%s %v: %v (%s, %d similar suppressed)", method, req, err, d, suppressed)
+    }
+  } else if glog.V(requestLevel(method)) {
+    if ok, suppressed := limiter.allow(method); ok {
+      glog.Infof("%s %v (%s, %d similar suppressed)", method, req, d, suppressed)
+    }
+  }
+
+  return resp, err
+}
@@ -0,0 +1,88 @@
+package service
+
+import (
+  "fmt"
+  "path/filepath"
+  "strings"
+  "time"
+
+  "github.com/golang/glog"
+)
+
+// NetnsPool keeps network namespaces, with address already leased,
+// prepared by `pod prepare` in background, so that RunPodSandbox only
+// has to `pod adopt` one of them.
+type NetnsPool struct {
+  Ready chan PreparedNetns
+
+  Node *string
+  BinDir *string
+  Refill time.Duration
+}
+
+type PreparedNetns struct {
+  Name string
+  Ip string
+}
+
+func NewNetnsPool(size int, refill time.Duration, node *string, bindir *string) *NetnsPool {
+  return &NetnsPool{
+    Ready: make(chan PreparedNetns, size),
+    Node: node,
+    BinDir: bindir,
+    Refill: refill,
+  }
+}
+
+// Run prepares at most one namespace every Refill, until there are
+// cap(Ready) of them waiting.
+func (p *NetnsPool) Run() {
+  pod := filepath.Join(*p.BinDir, "pod")
+
+  if err := Run(pod, "drain", *p.Node); err != nil {
+    glog.Errorf("drain netns pool: %v", err)
+  }
+
+  seq := time.Now().UnixNano()
+  ticker := time.NewTicker(p.Refill)
+  defer ticker.Stop()
+
+  for range ticker.C {
+    if len(p.Ready) == cap(p.Ready) {
+      continue
+    }
+
+    seq += 1
+    name := fmt.Sprintf("pool-%s-%d", *p.Node, seq)
+
+    output, err := Output(pod, "prepare", *p.Node, name)
+    if err != nil {
+      glog.Errorf("prepare netns %s: %v", name, err)
+      continue
+    }
+
+    p.Ready <- PreparedNetns{Name: name, Ip: strings.TrimSpace(string(output))}
+  }
+}
+
+// Get returns a prepared namespace if there is one, without waiting.
+func (p *NetnsPool) Get() (PreparedNetns, bool) {
+  if p == nil {
+    return PreparedNetns{}, false
+  }
+
+  select {
+  case netns := <-p.Ready:
+    return netns, true
+  default:
+    return PreparedNetns{}, false
+  }
+}
+
+// Release removes a namespace taken by Get but not adopted, and
+// releases its address.
+func (p *NetnsPool) Release(netns PreparedNetns) {
+  if err := Run(filepath.Join(*p.BinDir, "pod"), "remove", *p.Node, netns.Name, netns.Name, netns.Ip); err != nil {
+    glog.Errorf("remove netns %s: %v", netns.Name, err)
+  }
+}
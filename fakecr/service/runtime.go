@@ -25,12 +25,14 @@ import (
   "os"
   "os/exec"
   "path/filepath"
+  "strings"
+  "sync/atomic"
   "time"
-  "sync"
 
   "github.com/golang/glog"
   "golang.org/x/net/context"
   "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+  "k8s.io/kubernetes/pkg/kubelet/server/streaming"
 )
 
 var (
@@ -41,32 +43,72 @@ var (
 type FakePodSandbox struct {
   runtime.PodSandboxStatus
   Hostname string
+
+  // item of ListPodSandbox, built when stored in State
+  item *runtime.PodSandbox
 }
 
 type FakeContainer struct {
   runtime.ContainerStatus
   SandboxID string
+  Resources *runtime.LinuxContainerResources
+  // CPUs the container runs on exclusively, if any
+  ExclusiveCpus []int
+
+  // item of ListContainers, built when stored in State
+  item *runtime.Container
 }
 
 type FakeRuntimeService struct {
-  sync.Mutex
-
   FakeStatus *runtime.RuntimeStatus
-  Containers map[string]*FakeContainer
-  Sandboxes  map[string]*FakePodSandbox
+  State *State
+
+  // external commands on a sandbox and its containers are run one at
+  // a time, holding the lock of the sandbox id
+  SandboxLocks KeyedMutex
 
   Node *string
   RootDir *string
   BinDir *string
+  Unspawnd *string
+  Registry *string
+
+  // containers are started in cgroups under CgroupRoot if not empty
+  CgroupRoot *string
+  PidsMax int64
+
+  // containers are pinned to CPUs if not nil
+  Cpus *CpuAllocator
+
+  // stages of starting and removing pods, not bounded if nil
+  NetworkStage *Stage
+  ConfigStage *Stage
+  SpawnStage *Stage
+
+  // serves Exec and Attach if not nil
+  Streaming streaming.Server
+
+  // containers are started with an exec helper for ExecSync
+  ExecHelper bool
+
+  // phases of starting containers are traced by unspawn, and logged
+  TraceStartup bool
+
+  Pool *NetnsPool
+
+  // exit events are received from unspawn daemon, accessed atomically
+  Watching int32
 }
 
-func NewFakeRuntimeService(node *string, rootdir *string, bindir *string) *FakeRuntimeService {
+func NewFakeRuntimeService(node *string, rootdir *string, bindir *string, unspawnd *string, registry *string, cgroupRoot *string) *FakeRuntimeService {
   return &FakeRuntimeService{
-    Containers: make(map[string]*FakeContainer),
-    Sandboxes:  make(map[string]*FakePodSandbox),
+    State: NewState(),
     Node: node,
     RootDir: rootdir,
     BinDir: bindir,
+    Unspawnd: unspawnd,
+    Registry: registry,
+    CgroupRoot: cgroupRoot,
   }
 }
 
@@ -76,7 +118,10 @@ func Run(name string, arg ...string) error {
   cmd.Stdout = os.Stdout
   cmd.Stderr = os.Stderr
 
-  return cmd.Run()
+  start := time.Now()
+  err := cmd.Run()
+  metrics.observe(metrics.commands, commandName(name, arg), time.Since(start), err)
+  return err
 }
 
 func Output(name string, arg ...string) ([]byte, error) {
@@ -84,12 +129,14 @@ func Output(name string, arg ...string) ([]byte, error) {
   cmd.Stdin = os.Stdin
   cmd.Stderr = os.Stderr
 
-  return cmd.Output()
+  start := time.Now()
+  output, err := cmd.Output()
+  metrics.observe(metrics.commands, commandName(name, arg), time.Since(start), err)
+  return output, err
 }
 
 
 func (s *FakeRuntimeService) Version(ctx context.Context, req *runtime.VersionRequest) (*runtime.VersionResponse, error) {
-  glog.Infof("Version %s", req.String())
   return &runtime.VersionResponse{
     Version:           req.Version,
     RuntimeName:       FakeRuntimeName,
@@ -99,7 +146,6 @@ func (s *FakeRuntimeService) Version(ctx context.Context, req *runtime.VersionRe
 }
 
 func (s *FakeRuntimeService) Status(ctx context.Context, req *runtime.StatusRequest) (*runtime.StatusResponse, error) {
-  glog.Infof("Status %s", req.String())
   return &runtime.StatusResponse {
     Status: &runtime.RuntimeStatus {
       Conditions: []*runtime.RuntimeCondition{
@@ -117,55 +163,66 @@ func (s *FakeRuntimeService) Status(ctx context.Context, req *runtime.StatusRequ
 }
 
 func (s *FakeRuntimeService) RunPodSandbox(ctx context.Context, req *runtime.RunPodSandboxRequest) (*runtime.RunPodSandboxResponse, error) {
-  glog.Infof("RunPodSandbox %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   config := req.Config
   podSandboxID := BuildSandboxName(config.Metadata)
+  s.SandboxLocks.Lock(podSandboxID)
+  defer s.SandboxLocks.Unlock(podSandboxID)
+
   createdAt := time.Now().Unix()
   readyState := runtime.PodSandboxState_SANDBOX_READY
 
-  if err := Run(filepath.Join(*s.BinDir, "pod"), "create", *s.Node, podSandboxID, config.Hostname); err != nil {
+  // `pod create` prints the address it leased for the pod
+  var ip string
+  err := s.NetworkStage.Do(ctx, func() error {
+    if netns, ok := s.Pool.Get(); ok {
+      err := Run(filepath.Join(*s.BinDir, "pod"), "adopt", *s.Node, podSandboxID, config.Hostname, netns.Name)
+      if err == nil {
+        ip = netns.Ip
+        return nil
+      }
+      // a namespace failed to adopt is not leaked, the pod gets one of
+      // its own instead
+      glog.Warningf("adopt netns %s for %s: %v", netns.Name, podSandboxID, err)
+      s.Pool.Release(netns)
+    }
+
+    output, err := Output(filepath.Join(*s.BinDir, "pod"), "create", *s.Node, podSandboxID, config.Hostname)
+    if err != nil {
+      return err
+    }
+    ip = strings.TrimSpace(string(output))
+    return nil
+  })
+  if err != nil {
     return nil, err
   }
 
-  if output, err := Output(filepath.Join(*s.BinDir, "showip"), config.Hostname); err != nil {
-    return nil, err
-  } else {
-    ip := string(output[:])
-
-    s.Sandboxes[podSandboxID] = &FakePodSandbox {
-      PodSandboxStatus: runtime.PodSandboxStatus {
-        Id:        podSandboxID,
-        Metadata:  config.Metadata,
-        State:     readyState,
-        CreatedAt: createdAt,
-        Network: &runtime.PodSandboxNetworkStatus{
-          Ip: ip,
-        },
-        Labels:      config.Labels,
-        Annotations: config.Annotations,
+  s.State.PutSandbox(&FakePodSandbox {
+    PodSandboxStatus: runtime.PodSandboxStatus {
+      Id:        podSandboxID,
+      Metadata:  config.Metadata,
+      State:     readyState,
+      CreatedAt: createdAt,
+      Network: &runtime.PodSandboxNetworkStatus{
+        Ip: ip,
       },
-      Hostname: config.Hostname,
-    }
+      Labels:      config.Labels,
+      Annotations: config.Annotations,
+    },
+    Hostname: config.Hostname,
+  })
 
-    return &runtime.RunPodSandboxResponse{
-      PodSandboxId: podSandboxID,
-    }, nil
-  }
+  return &runtime.RunPodSandboxResponse{
+    PodSandboxId: podSandboxID,
+  }, nil
 }
 
 func (s *FakeRuntimeService) StopPodSandbox(ctx context.Context, req *runtime.StopPodSandboxRequest) (*runtime.StopPodSandboxResponse, error) {
-  glog.Infof("StopPodSandbox %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   podSandboxID := req.PodSandboxId
   notReadyState := runtime.PodSandboxState_SANDBOX_NOTREADY
-  if sb, ok := s.Sandboxes[podSandboxID]; ok {
-    sb.State = notReadyState
-  } else {
+  if !s.State.UpdateSandbox(podSandboxID, func(sb *FakePodSandbox) { sb.State = notReadyState }) {
     return nil, fmt.Errorf("pod sandbox %s not found", podSandboxID)
   }
 
@@ -174,28 +231,33 @@ func (s *FakeRuntimeService) StopPodSandbox(ctx context.Context, req *runtime.St
 }
 
 func (s *FakeRuntimeService) RemovePodSandbox(ctx context.Context, req *runtime.RemovePodSandboxRequest) (*runtime.RemovePodSandboxResponse, error) {
-  glog.Infof("RemovePodSandbox %s", req.String())
-  s.Lock()
-  defer s.Unlock()
   podSandboxID := req.PodSandboxId
+  s.SandboxLocks.Lock(podSandboxID)
+  defer s.SandboxLocks.Unlock(podSandboxID)
 
-  if sb, ok := s.Sandboxes[podSandboxID]; ok {
-    Run(filepath.Join(*s.BinDir, "pod"), "remove", *s.Node, podSandboxID, sb.Hostname)
+  if sb, ok := s.State.Sandbox(podSandboxID); ok {
+    err := s.NetworkStage.Do(ctx, func() error {
+      Run(filepath.Join(*s.BinDir, "pod"), "remove", *s.Node, podSandboxID, sb.Hostname, sb.Network.Ip)
+      return nil
+    })
+    if err != nil {
+      return nil, err
+    }
+    if *s.CgroupRoot != "" {
+      os.Remove(filepath.Join(*s.CgroupRoot, *s.Node, podSandboxID))
+    }
   } else {
     return nil, fmt.Errorf("pod sandbox %s not found", podSandboxID)
   }
 
-  delete(s.Sandboxes, podSandboxID)
+  s.State.DeleteSandbox(podSandboxID)
   return &runtime.RemovePodSandboxResponse {
   }, nil
 }
 
 func (s *FakeRuntimeService) PodSandboxStatus(ctx context.Context, req *runtime.PodSandboxStatusRequest) (*runtime.PodSandboxStatusResponse, error) {
-  glog.Infof("PodSandboxStatus %s", req.String())
-  s.Lock()
-  defer s.Unlock()
   podSandboxID := req.PodSandboxId
-  sb, ok := s.Sandboxes[podSandboxID]
+  sb, ok := s.State.Sandbox(podSandboxID)
   if !ok {
     return nil, fmt.Errorf("pod sandbox %q not found", podSandboxID)
   }
@@ -206,44 +268,13 @@ func (s *FakeRuntimeService) PodSandboxStatus(ctx context.Context, req *runtime.
 }
 
 func (s *FakeRuntimeService) ListPodSandbox(ctx context.Context, req *runtime.ListPodSandboxRequest) (*runtime.ListPodSandboxResponse, error) {
-  glog.Infof("ListPodSandbox %s", req.String())
-  s.Lock()
-  defer s.Unlock()
-
-  filter := req.Filter
-  result := make([]*runtime.PodSandbox, 0)
-  for id, sb := range s.Sandboxes {
-    if filter != nil {
-      if filter.Id != "" && filter.Id != id {
-        continue
-      }
-      if filter.State != nil && filter.GetState().State != sb.State {
-        continue
-      }
-      if filter.LabelSelector != nil && !filterInLabels(filter.LabelSelector, sb.GetLabels()) {
-        continue
-      }
-    }
-
-    result = append(result, &runtime.PodSandbox{
-      Id:          sb.Id,
-      Metadata:    sb.Metadata,
-      State:       sb.State,
-      CreatedAt:   sb.CreatedAt,
-      Labels:      sb.Labels,
-      Annotations: sb.Annotations,
-    })
-  }
 
   return &runtime.ListPodSandboxResponse {
-    Items: result,
+    Items: s.State.ListSandboxes(req.Filter),
   }, nil
 }
 
 func (s *FakeRuntimeService) PortForward(ctx context.Context, req *runtime.PortForwardRequest) (*runtime.PortForwardResponse, error) {
-  glog.Infof("PortForward %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   return &runtime.PortForwardResponse{}, nil
 }
@@ -277,12 +308,11 @@ func WriteInit(path string, envs []*runtime.KeyValue, mounts []*runtime.Mount) e
 
 
 func (s *FakeRuntimeService) CreateContainer(ctx context.Context, req *runtime.CreateContainerRequest) (*runtime.CreateContainerResponse, error) {
-  glog.Infof("CreateContainer %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   config := req.Config
   podSandboxID := req.PodSandboxId
+  s.SandboxLocks.Lock(podSandboxID)
+  defer s.SandboxLocks.Unlock(podSandboxID)
 
   containerID := BuildContainerName(config.Metadata, podSandboxID)
   createdAt := time.Now().Unix()
@@ -290,11 +320,14 @@ func (s *FakeRuntimeService) CreateContainer(ctx context.Context, req *runtime.C
   imageRef := config.Image.Image
 
   path := filepath.Join(*s.RootDir, "nodes", *s.Node, "pods", podSandboxID, containerID + ".sh")
-  if err := WriteInit(path, config.Envs, config.Mounts); err != nil {
+  err := s.ConfigStage.Do(ctx, func() error {
+    return WriteInit(path, config.Envs, config.Mounts)
+  })
+  if err != nil {
     return nil, err
   }
 
-  s.Containers[containerID] = &FakeContainer{
+  s.State.PutContainer(&FakeContainer{
     ContainerStatus: runtime.ContainerStatus {
       Id:          containerID,
       Metadata:    config.Metadata,
@@ -306,7 +339,8 @@ func (s *FakeRuntimeService) CreateContainer(ctx context.Context, req *runtime.C
       Annotations: config.Annotations,
     },
     SandboxID: podSandboxID,
-  }
+    Resources: config.GetLinux().GetResources(),
+  })
 
   return &runtime.CreateContainerResponse {
     ContainerId: containerID,
@@ -314,51 +348,119 @@ func (s *FakeRuntimeService) CreateContainer(ctx context.Context, req *runtime.C
 }
 
 func (s *FakeRuntimeService) StartContainer(ctx context.Context, req *runtime.StartContainerRequest) (*runtime.StartContainerResponse, error) {
-  glog.Infof("StartContainer %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   containerID := req.ContainerId
-  c, ok := s.Containers[containerID]
+  c, ok := s.State.Container(containerID)
   if !ok {
     return nil, fmt.Errorf("container %s not found", containerID)
   }
 
   podSandboxID := c.SandboxID
-  sb, ok := s.Sandboxes[podSandboxID]
+  s.SandboxLocks.Lock(podSandboxID)
+  defer s.SandboxLocks.Unlock(podSandboxID)
+
+  sb, ok := s.State.Sandbox(podSandboxID)
   if !ok {
     return nil, fmt.Errorf("podsandbox %s not found", podSandboxID)
   }
 
   startedAt := time.Now().Unix()
   runningState := runtime.ContainerState_CONTAINER_RUNNING
-  c.State = runningState
-  c.StartedAt = startedAt
+  var exclusiveCpus []int
 
-  if err := Run(filepath.Join(*s.BinDir, "ct"), "start", *s.Node, podSandboxID, sb.Hostname, containerID, c.ImageRef); err != nil {
-    return nil, err
+  if *s.Unspawnd != "" {
+    podDir := filepath.Join(*s.RootDir, "nodes", *s.Node, "pods", podSandboxID)
+    runDir := filepath.Join("/run/containers", *s.Node, podSandboxID)
+
+    arg := []string{"-n", sb.Hostname, "--pidfile=" + filepath.Join(runDir, containerID + ".pid"), "--exit-status=" + filepath.Join(runDir, containerID + ".exit")}
+    if *s.Registry != "" {
+      arg = append(arg, "--registry=" + *s.Registry)
+    }
+    if *s.CgroupRoot != "" {
+      arg = append(arg, CgroupArgs(*s.CgroupRoot, *s.Node, podSandboxID, containerID, c.Resources, s.PidsMax)...)
+    }
+    if s.ExecHelper {
+      socket := s.ExecSocket(containerID)
+      if err := os.MkdirAll(filepath.Dir(socket), 0700); err != nil {
+        return nil, err
+      }
+      arg = append(arg, "--exec-socket=" + socket, "--exec-context=" + filepath.Join(runDir, containerID + ".context"))
+    }
+    if s.Cpus != nil {
+      cpuArgs, err := s.Cpus.CpuArgs(containerID, c.Resources)
+      if err != nil {
+        return nil, err
+      }
+      arg = append(arg, cpuArgs...)
+      exclusiveCpus = s.Cpus.Owned(containerID)
+    }
+    trace := filepath.Join(runDir, containerID + ".trace")
+    if s.TraceStartup {
+      arg = append(arg, "--trace=" + trace)
+    }
+    arg = append(arg, "--net=" + sb.Hostname, "--no-pid", "--no-cgroup", "--",
+      filepath.Join(*s.BinDir, "init"), *s.Node, podSandboxID, containerID, c.ImageRef)
+
+    queuedAt := time.Now()
+    var queued time.Duration
+    err := s.SpawnStage.Do(ctx, func() error {
+      queued = time.Since(queuedAt)
+      _, err := Spawn(*s.Unspawnd, filepath.Join(podDir, containerID + ".out"), filepath.Join(podDir, containerID + ".err"), arg...)
+      return err
+    })
+    if err != nil {
+      if s.Cpus != nil {
+        s.Cpus.Release(containerID)
+      }
+      return nil, err
+    }
+
+    if s.TraceStartup {
+      time.AfterFunc(traceDelay, func() { reportTrace(containerID, trace, queued) })
+    }
+  } else {
+    err := s.SpawnStage.Do(ctx, func() error {
+      return Run(filepath.Join(*s.BinDir, "ct"), "start", *s.Node, podSandboxID, sb.Hostname, containerID, c.ImageRef)
+    })
+    if err != nil {
+      return nil, err
+    }
   }
 
+  // marked running only once started, so that it is not checked before
+  // its pidfile is written. If it has already exited, it stays exited.
+  s.State.UpdateContainer(containerID, func(c *FakeContainer) bool {
+    if c.State == runtime.ContainerState_CONTAINER_CREATED {
+      c.State = runningState
+    }
+    c.StartedAt = startedAt
+    c.ExclusiveCpus = exclusiveCpus
+    return true
+  })
+
   return &runtime.StartContainerResponse {
   }, nil
 }
 
 func (s *FakeRuntimeService) StopContainer(ctx context.Context, req *runtime.StopContainerRequest) (*runtime.StopContainerResponse, error) {
-  glog.Infof("StopContainer %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   containerID := req.ContainerId
-  c, ok := s.Containers[containerID]
+  c, ok := s.State.Container(containerID)
   if !ok {
     return nil, fmt.Errorf("container %q not found", containerID)
   }
 
+  s.SandboxLocks.Lock(c.SandboxID)
+  defer s.SandboxLocks.Unlock(c.SandboxID)
+
   // Set container to exited state.
   finishedAt := time.Now().Unix()
   exitedState := runtime.ContainerState_CONTAINER_EXITED
-  c.State = exitedState
-  c.FinishedAt = finishedAt
+  s.State.UpdateContainer(containerID, func(c *FakeContainer) bool {
+    c.State = exitedState
+    c.FinishedAt = finishedAt
+    return true
+  })
 
   if err := Run(filepath.Join(*s.BinDir, "ct"), "stop", *s.Node, c.SandboxID, containerID); err != nil {
     return nil, err
@@ -369,81 +471,98 @@ func (s *FakeRuntimeService) StopContainer(ctx context.Context, req *runtime.Sto
 }
 
 func (s *FakeRuntimeService) RemoveContainer(ctx context.Context, req *runtime.RemoveContainerRequest) (*runtime.RemoveContainerResponse, error) {
-  glog.Infof("RemoveContainer %s", req.String())
-  s.Lock()
-  defer s.Unlock()
   containerID := req.ContainerId
-  delete(s.Containers, containerID)
+  s.State.DeleteContainer(containerID)
+  if s.Cpus != nil {
+    s.Cpus.Release(containerID)
+  }
+  if s.ExecHelper {
+    os.Remove(s.ExecSocket(containerID))
+  }
   return &runtime.RemoveContainerResponse {
   }, nil
 }
 
-func (s *FakeRuntimeService) CheckState(c *FakeContainer) {
-  if c.State != runtime.ContainerState_CONTAINER_RUNNING {
+// CheckState returns container, marked exited if it is no longer
+// running. While exit events are watched, its state is up to date
+// already.
+func (s *FakeRuntimeService) CheckState(c *FakeContainer) *FakeContainer {
+  if c.State != runtime.ContainerState_CONTAINER_RUNNING || atomic.LoadInt32(&s.Watching) != 0 {
+    return c
+  }
+
+  if err := Run(filepath.Join(*s.BinDir, "ct"), "check", *s.Node, c.SandboxID, c.Id); err == nil {
+    return c
+  }
+
+  s.ReadExitStatus(c)
+  if updated, ok := s.State.Container(c.Id); ok {
+    return updated
+  }
+  return c
+}
+
+// CheckStates checks all running containers with one `uncheck --batch`
+// instead of one `ct check` per container.
+func (s *FakeRuntimeService) CheckStates() {
+  running := []*FakeContainer{}
+  for _, c := range s.State.Containers() {
+    if c.State == runtime.ContainerState_CONTAINER_RUNNING {
+      running = append(running, c)
+    }
+  }
+
+  if len(running) == 0 {
     return
   }
 
-  if err := Run(filepath.Join(*s.BinDir, "ct"), "check", *s.Node, c.SandboxID, c.Id); err != nil {
-    c.State = runtime.ContainerState_CONTAINER_EXITED
+  arg := []string{"--batch=" + filepath.Join("/run/containers", *s.Node)}
+  if *s.Registry != "" {
+    arg = append(arg, "--registry=" + *s.Registry)
+  }
+
+  output, err := Output(filepath.Join(*s.BinDir, "uncheck"), arg...)
+  if err != nil {
+    glog.Errorf("check containers: %v", err)
+    return
+  }
+
+  alive := make(map[string]bool)
+  for _, line := range strings.Split(string(output), "\n") {
+    fields := strings.Split(line, "\t")
+    if len(fields) == 2 && fields[1] == "running" {
+      alive[fields[0]] = true
+    }
+  }
+
+  for _, c := range running {
+    if !alive[c.SandboxID + "/" + c.Id] {
+      s.ReadExitStatus(c)
+    }
   }
 }
 
 func (s *FakeRuntimeService) ListContainers(ctx context.Context, req *runtime.ListContainersRequest) (*runtime.ListContainersResponse, error) {
-  glog.Infof("ListContainers %s", req.String())
-  s.Lock()
-  defer s.Unlock()
-
-  filter := req.Filter;
-  result := make([]*runtime.Container, 0)
-  for _, c := range s.Containers {
-    s.CheckState(c)
-
-    if filter != nil {
-      if filter.Id != "" && filter.Id != c.Id {
-        continue
-      }
-      if filter.PodSandboxId != "" && filter.PodSandboxId != c.SandboxID {
-        continue
-      }
-      if filter.State != nil && filter.GetState().State != c.State {
-        continue
-      }
-      if filter.LabelSelector != nil && !filterInLabels(filter.LabelSelector, c.GetLabels()) {
-        continue
-      }
-    }
 
-    result = append(result, &runtime.Container{
-      Id:           c.Id,
-      CreatedAt:    c.CreatedAt,
-      PodSandboxId: c.SandboxID,
-      Metadata:     c.Metadata,
-      State:        c.State,
-      Image:        c.Image,
-      ImageRef:     c.ImageRef,
-      Labels:       c.Labels,
-      Annotations:  c.Annotations,
-    })
+  if atomic.LoadInt32(&s.Watching) == 0 {
+    s.CheckStates()
   }
 
   return &runtime.ListContainersResponse {
-    Containers: result,
+    Containers: s.State.ListContainers(req.Filter),
   }, nil
 }
 
 func (s *FakeRuntimeService) ContainerStatus(ctx context.Context, req *runtime.ContainerStatusRequest) (*runtime.ContainerStatusResponse, error) {
-  glog.Infof("ContainerStatus %s", req.String())
-  s.Lock()
-  defer s.Unlock()
 
   containerID := req.ContainerId
 
-  c, ok := s.Containers[containerID]
+  c, ok := s.State.Container(containerID)
   if !ok {
     return nil, fmt.Errorf("container %q not found", containerID)
   }
 
-  s.CheckState(c)
+  c = s.CheckState(c)
 
   return &runtime.ContainerStatusResponse {
     Status: &c.ContainerStatus,
@@ -451,33 +570,24 @@ func (s *FakeRuntimeService) ContainerStatus(ctx context.Context, req *runtime.C
 }
 
 func (s *FakeRuntimeService) ExecSync(ctx context.Context, req *runtime.ExecSyncRequest) (*runtime.ExecSyncResponse, error) {
-  glog.Infof("ExecSync %s", req.String())
-  s.Lock()
-  defer s.Unlock()
-  return &runtime.ExecSyncResponse {
-    Stdout: nil,
-    Stderr: nil,
-    ExitCode: -1,
-  }, nil
+  return s.execSync(ctx, req.ContainerId, req.Cmd, req.Timeout)
 }
 
 func (s *FakeRuntimeService) Exec(ctx context.Context, req *runtime.ExecRequest) (*runtime.ExecResponse, error) {
-  glog.Infof("Exec %s", req.String())
-  s.Lock()
-  defer s.Unlock()
-  return &runtime.ExecResponse{}, nil
+  if s.Streaming == nil {
+    return nil, fmt.Errorf("streaming server not enabled")
+  }
+  return s.Streaming.GetExec(req)
 }
 
 func (s *FakeRuntimeService) Attach(ctx context.Context, req *runtime.AttachRequest) (*runtime.AttachResponse, error) {
-  glog.Infof("Attach %s", req.String())
-  s.Lock()
-  defer s.Unlock()
-
-  return &runtime.AttachResponse{}, nil
+  if s.Streaming == nil {
+    return nil, fmt.Errorf("streaming server not enabled")
+  }
+  return s.Streaming.GetAttach(req)
 }
 
 func (s *FakeRuntimeService) UpdateRuntimeConfig(ctx context.Context, req *runtime.UpdateRuntimeConfigRequest) (*runtime.UpdateRuntimeConfigResponse, error) {
-  glog.Infof("UpdateRuntimeConfig %s", req.String())
   return &runtime.UpdateRuntimeConfigResponse {
   }, nil
 }
@@ -0,0 +1,71 @@
+package service
+
+import (
+  "fmt"
+  "net"
+  "os"
+  "strconv"
+  "strings"
+  "syscall"
+  "time"
+)
+
+// Spawn asks the unspawn daemon listening on socket to start a
+// process, same as `unspawn --connect=socket arg...`, without forking
+// a client. stdout and stderr of the process are redirected to files.
+func Spawn(socket string, stdout string, stderr string, arg ...string) (int, error) {
+  start := time.Now()
+  pid, err := spawn(socket, stdout, stderr, arg)
+  metrics.observe(metrics.commands, "spawn", time.Since(start), err)
+  return pid, err
+}
+
+func spawn(socket string, stdout string, stderr string, arg []string) (int, error) {
+  stdin, err := os.Open(os.DevNull)
+  if err != nil {
+    return -1, err
+  }
+  defer stdin.Close()
+
+  out, err := os.OpenFile(stdout, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+  if err != nil {
+    return -1, err
+  }
+  defer out.Close()
+
+  errfile, err := os.OpenFile(stderr, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+  if err != nil {
+    return -1, err
+  }
+  defer errfile.Close()
+
+  conn, err := net.DialUnix("unixpacket", nil, &net.UnixAddr{Name: socket, Net: "unixpacket"})
+  if err != nil {
+    return -1, err
+  }
+  defer conn.Close()
+
+  payload := []byte(strings.Join(arg, "\x00") + "\x00")
+  rights := syscall.UnixRights(int(stdin.Fd()), int(out.Fd()), int(errfile.Fd()))
+
+  if _, _, err := conn.WriteMsgUnix(payload, rights, nil); err != nil {
+    return -1, err
+  }
+
+  reply := make([]byte, 16)
+  n, err := conn.Read(reply)
+  if err != nil {
+    return -1, err
+  }
+
+  pid, err := strconv.Atoi(string(reply[:n]))
+  if err != nil {
+    return -1, err
+  }
+
+  if pid < 0 {
+    return -1, fmt.Errorf("unspawn daemon failed to spawn %v", arg)
+  }
+
+  return pid, nil
+}
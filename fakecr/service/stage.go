@@ -0,0 +1,62 @@
+package service
+
+import (
+  "fmt"
+
+  "golang.org/x/net/context"
+)
+
+// Stage bounds the number of concurrent operations of one kind, e.g.
+// setting up pod networks, and of those admitted, running or waiting
+// for their turn. Pods started at the same time go through stages in
+// parallel, each stage taking at most as many of them as its workers.
+type Stage struct {
+  Name string
+  slots chan struct{}
+  // nil if number of admitted operations is not bounded
+  queue chan struct{}
+}
+
+// NewStage returns nil, i.e. no bound, if workers is 0
+func NewStage(name string, workers int, queue int) *Stage {
+  if workers <= 0 {
+    return nil
+  }
+
+  st := &Stage{
+    Name: name,
+    slots: make(chan struct{}, workers),
+  }
+  if queue > 0 {
+    st.queue = make(chan struct{}, queue)
+  }
+  return st
+}
+
+// Do runs f once a slot of the stage is free, and f alone if stage is
+// nil. It gives up without running f if the queue is full, or ctx is
+// done before its turn, e.g. deadline of kubelet expired, so that no
+// work is started that nobody waits for.
+func (st *Stage) Do(ctx context.Context, f func() error) error {
+  if st == nil {
+    return f()
+  }
+
+  if st.queue != nil {
+    select {
+    case st.queue <- struct{}{}:
+      defer func() { <-st.queue }()
+    default:
+      return fmt.Errorf("%s: too many operations waiting", st.Name)
+    }
+  }
+
+  select {
+  case st.slots <- struct{}{}:
+  case <-ctx.Done():
+    return fmt.Errorf("%s: %v", st.Name, ctx.Err())
+  }
+  defer func() { <-st.slots }()
+
+  return f()
+}
@@ -0,0 +1,498 @@
+package service
+
+import (
+  "fmt"
+  "hash/fnv"
+  "sync"
+  "sync/atomic"
+
+  "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+)
+
+const stateShards = 16
+
+// index maps a key, e.g. a state or a label, to ids of sandboxes or
+// containers having it
+type index map[string]map[string]bool
+
+func stateKey(state int32) string {
+  return fmt.Sprintf("state\x00%d", state)
+}
+
+func labelKey(k, v string) string {
+  return "label\x00" + k + "\x00" + v
+}
+
+func sandboxKey(id string) string {
+  return "sandbox\x00" + id
+}
+
+func sandboxKeys(sb *FakePodSandbox) []string {
+  keys := []string{stateKey(int32(sb.State))}
+  for k, v := range sb.Labels {
+    keys = append(keys, labelKey(k, v))
+  }
+  return keys
+}
+
+func containerKeys(c *FakeContainer) []string {
+  keys := []string{sandboxKey(c.SandboxID), stateKey(int32(c.State))}
+  for k, v := range c.Labels {
+    keys = append(keys, labelKey(k, v))
+  }
+  return keys
+}
+
+// snapshot of a shard. Neither the maps nor the sandboxes and
+// containers in them are modified once published, writers replace
+// them with changed copies instead, so readers never lock.
+type shardState struct {
+  Sandboxes map[string]*FakePodSandbox
+  Containers map[string]*FakeContainer
+
+  SandboxIndex index
+  ContainerIndex index
+
+  // sets of indexes already copied by the writer, keyed by index kind
+  // and key, and changes to journal, nil once published
+  owned map[string]bool
+  records []record
+}
+
+// set returns ids of key in ix, copied if published before
+func (st *shardState) set(ix index, kind string, key string) map[string]bool {
+  if st.owned[kind + key] {
+    return ix[key]
+  }
+
+  ids := make(map[string]bool, len(ix[key]) + 1)
+  for id := range ix[key] {
+    ids[id] = true
+  }
+  ix[key] = ids
+  st.owned[kind + key] = true
+  return ids
+}
+
+func (st *shardState) unindex(ix index, kind string, keys []string, id string) {
+  for _, key := range keys {
+    ids := st.set(ix, kind, key)
+    delete(ids, id)
+    if len(ids) == 0 {
+      delete(ix, key)
+      delete(st.owned, kind + key)
+    }
+  }
+}
+
+func (st *shardState) index(ix index, kind string, keys []string, id string) {
+  for _, key := range keys {
+    st.set(ix, kind, key)[id] = true
+  }
+}
+
+func (st *shardState) putSandbox(sb *FakePodSandbox) {
+  if old, ok := st.Sandboxes[sb.Id]; ok {
+    st.unindex(st.SandboxIndex, "s", sandboxKeys(old), old.Id)
+  }
+  sb.item = &runtime.PodSandbox{
+    Id:          sb.Id,
+    Metadata:    sb.Metadata,
+    State:       sb.State,
+    CreatedAt:   sb.CreatedAt,
+    Labels:      sb.Labels,
+    Annotations: sb.Annotations,
+  }
+  st.Sandboxes[sb.Id] = sb
+  st.index(st.SandboxIndex, "s", sandboxKeys(sb), sb.Id)
+  st.records = append(st.records, record{Sandbox: sb})
+}
+
+func (st *shardState) deleteSandbox(id string) {
+  if old, ok := st.Sandboxes[id]; ok {
+    st.unindex(st.SandboxIndex, "s", sandboxKeys(old), id)
+    delete(st.Sandboxes, id)
+    st.records = append(st.records, record{RemoveSandbox: id})
+  }
+}
+
+func (st *shardState) putContainer(c *FakeContainer) {
+  if old, ok := st.Containers[c.Id]; ok {
+    st.unindex(st.ContainerIndex, "c", containerKeys(old), old.Id)
+  }
+  c.item = &runtime.Container{
+    Id:           c.Id,
+    CreatedAt:    c.CreatedAt,
+    PodSandboxId: c.SandboxID,
+    Metadata:     c.Metadata,
+    State:        c.State,
+    Image:        c.Image,
+    ImageRef:     c.ImageRef,
+    Labels:       c.Labels,
+    Annotations:  c.Annotations,
+  }
+  st.Containers[c.Id] = c
+  st.index(st.ContainerIndex, "c", containerKeys(c), c.Id)
+  st.records = append(st.records, record{Container: c})
+}
+
+func (st *shardState) deleteContainer(id string) {
+  if old, ok := st.Containers[id]; ok {
+    st.unindex(st.ContainerIndex, "c", containerKeys(old), id)
+    delete(st.Containers, id)
+    st.records = append(st.records, record{RemoveContainer: id})
+  }
+}
+
+// smallest returns ids of the key with fewest of them, all is true if
+// there are no keys to narrow by
+func smallest(ix index, keys []string) (ids map[string]bool, all bool) {
+  if len(keys) == 0 {
+    return nil, true
+  }
+
+  for i, key := range keys {
+    if i == 0 || len(ix[key]) < len(ids) {
+      ids = ix[key]
+    }
+  }
+  return ids, false
+}
+
+type shard struct {
+  // serializes writers of the shard
+  sync.Mutex
+  state atomic.Value
+}
+
+func (sh *shard) load() *shardState {
+  return sh.state.Load().(*shardState)
+}
+
+// update publishes a copy of the snapshot changed by f, f returns
+// false to leave the snapshot as is. Sets of the indexes are copied
+// only when f changes them. Changes are appended to j, in the order
+// they are published, and the sequence number to wait for returned.
+func (sh *shard) update(j *Journal, f func(st *shardState) bool) (bool, uint64) {
+  sh.Lock()
+  defer sh.Unlock()
+
+  old := sh.load()
+  st := &shardState{
+    Sandboxes: make(map[string]*FakePodSandbox, len(old.Sandboxes)),
+    Containers: make(map[string]*FakeContainer, len(old.Containers)),
+    SandboxIndex: make(index, len(old.SandboxIndex)),
+    ContainerIndex: make(index, len(old.ContainerIndex)),
+    owned: make(map[string]bool),
+  }
+  for id, sb := range old.Sandboxes {
+    st.Sandboxes[id] = sb
+  }
+  for id, c := range old.Containers {
+    st.Containers[id] = c
+  }
+  for key, ids := range old.SandboxIndex {
+    st.SandboxIndex[key] = ids
+  }
+  for key, ids := range old.ContainerIndex {
+    st.ContainerIndex[key] = ids
+  }
+
+  if !f(st) {
+    return false, 0
+  }
+
+  records := st.records
+  st.owned = nil
+  st.records = nil
+  sh.state.Store(st)
+  return true, j.Append(records)
+}
+
+// State holds sandboxes and containers of the runtime, sharded by
+// their id, so that a write copies only one shard. Each shard indexes
+// its sandboxes and containers by state and labels, and containers by
+// sandbox too, so that filtered lists only visit what they return.
+type State struct {
+  shards [stateShards]shard
+
+  // changes are journaled if not nil
+  Journal *Journal
+}
+
+func NewState() *State {
+  st := &State{}
+  for i := range st.shards {
+    st.shards[i].state.Store(&shardState{
+      Sandboxes: make(map[string]*FakePodSandbox),
+      Containers: make(map[string]*FakeContainer),
+      SandboxIndex: make(index),
+      ContainerIndex: make(index),
+    })
+  }
+  return st
+}
+
+func (st *State) shard(id string) *shard {
+  h := fnv.New32a()
+  h.Write([]byte(id))
+  return &st.shards[h.Sum32() % stateShards]
+}
+
+// update changes shard of id, and waits for the change to be synced
+// to journal
+func (st *State) update(id string, f func(s *shardState) bool) bool {
+  ok, seq := st.shard(id).update(st.Journal, f)
+  st.Journal.Wait(seq)
+  return ok
+}
+
+func (st *State) Sandbox(id string) (*FakePodSandbox, bool) {
+  sb, ok := st.shard(id).load().Sandboxes[id]
+  return sb, ok
+}
+
+func (st *State) Container(id string) (*FakeContainer, bool) {
+  c, ok := st.shard(id).load().Containers[id]
+  return c, ok
+}
+
+func (st *State) Sandboxes() []*FakePodSandbox {
+  result := []*FakePodSandbox{}
+  for i := range st.shards {
+    for _, sb := range st.shards[i].load().Sandboxes {
+      result = append(result, sb)
+    }
+  }
+  return result
+}
+
+func (st *State) Containers() []*FakeContainer {
+  result := []*FakeContainer{}
+  for i := range st.shards {
+    for _, c := range st.shards[i].load().Containers {
+      result = append(result, c)
+    }
+  }
+  return result
+}
+
+func matchSandbox(sb *FakePodSandbox, filter *runtime.PodSandboxFilter) bool {
+  if filter == nil {
+    return true
+  }
+  if filter.Id != "" && filter.Id != sb.Id {
+    return false
+  }
+  if filter.State != nil && filter.GetState().State != sb.State {
+    return false
+  }
+  if filter.LabelSelector != nil && !filterInLabels(filter.LabelSelector, sb.GetLabels()) {
+    return false
+  }
+  return true
+}
+
+func matchContainer(c *FakeContainer, filter *runtime.ContainerFilter) bool {
+  if filter == nil {
+    return true
+  }
+  if filter.Id != "" && filter.Id != c.Id {
+    return false
+  }
+  if filter.PodSandboxId != "" && filter.PodSandboxId != c.SandboxID {
+    return false
+  }
+  if filter.State != nil && filter.GetState().State != c.State {
+    return false
+  }
+  if filter.LabelSelector != nil && !filterInLabels(filter.LabelSelector, c.GetLabels()) {
+    return false
+  }
+  return true
+}
+
+// ListSandboxes returns sandboxes matching filter, as cached list
+// items, which must not be modified
+func (st *State) ListSandboxes(filter *runtime.PodSandboxFilter) []*runtime.PodSandbox {
+  result := make([]*runtime.PodSandbox, 0)
+  if filter != nil && filter.Id != "" {
+    if sb, ok := st.Sandbox(filter.Id); ok && matchSandbox(sb, filter) {
+      result = append(result, sb.item)
+    }
+    return result
+  }
+
+  keys := []string{}
+  if filter != nil {
+    if filter.State != nil {
+      keys = append(keys, stateKey(int32(filter.GetState().State)))
+    }
+    for k, v := range filter.LabelSelector {
+      keys = append(keys, labelKey(k, v))
+    }
+  }
+
+  for i := range st.shards {
+    s := st.shards[i].load()
+    ids, all := smallest(s.SandboxIndex, keys)
+    if all {
+      for _, sb := range s.Sandboxes {
+        result = append(result, sb.item)
+      }
+      continue
+    }
+
+    for id := range ids {
+      if sb := s.Sandboxes[id]; matchSandbox(sb, filter) {
+        result = append(result, sb.item)
+      }
+    }
+  }
+  return result
+}
+
+// ListContainers returns containers matching filter, as cached list
+// items, which must not be modified
+func (st *State) ListContainers(filter *runtime.ContainerFilter) []*runtime.Container {
+  result := make([]*runtime.Container, 0)
+  if filter != nil && filter.Id != "" {
+    if c, ok := st.Container(filter.Id); ok && matchContainer(c, filter) {
+      result = append(result, c.item)
+    }
+    return result
+  }
+
+  keys := []string{}
+  if filter != nil {
+    if filter.PodSandboxId != "" {
+      keys = append(keys, sandboxKey(filter.PodSandboxId))
+    }
+    if filter.State != nil {
+      keys = append(keys, stateKey(int32(filter.GetState().State)))
+    }
+    for k, v := range filter.LabelSelector {
+      keys = append(keys, labelKey(k, v))
+    }
+  }
+
+  for i := range st.shards {
+    s := st.shards[i].load()
+    ids, all := smallest(s.ContainerIndex, keys)
+    if all {
+      for _, c := range s.Containers {
+        result = append(result, c.item)
+      }
+      continue
+    }
+
+    for id := range ids {
+      if c := s.Containers[id]; matchContainer(c, filter) {
+        result = append(result, c.item)
+      }
+    }
+  }
+  return result
+}
+
+func (st *State) PutSandbox(sb *FakePodSandbox) {
+  st.update(sb.Id, func(s *shardState) bool {
+    s.putSandbox(sb)
+    return true
+  })
+}
+
+func (st *State) PutContainer(c *FakeContainer) {
+  st.update(c.Id, func(s *shardState) bool {
+    s.putContainer(c)
+    return true
+  })
+}
+
+// UpdateSandbox replaces sandbox with a copy changed by f, returns
+// false if there is no such sandbox
+func (st *State) UpdateSandbox(id string, f func(sb *FakePodSandbox)) bool {
+  return st.update(id, func(s *shardState) bool {
+    old, ok := s.Sandboxes[id]
+    if !ok {
+      return false
+    }
+
+    sb := *old
+    f(&sb)
+    s.putSandbox(&sb)
+    return true
+  })
+}
+
+// UpdateContainer replaces container with a copy changed by f, f
+// returns false to leave it as is
+func (st *State) UpdateContainer(id string, f func(c *FakeContainer) bool) bool {
+  return st.update(id, func(s *shardState) bool {
+    old, ok := s.Containers[id]
+    if !ok {
+      return false
+    }
+
+    c := *old
+    if !f(&c) {
+      return false
+    }
+    s.putContainer(&c)
+    return true
+  })
+}
+
+func (st *State) DeleteSandbox(id string) {
+  st.update(id, func(s *shardState) bool {
+    s.deleteSandbox(id)
+    return true
+  })
+}
+
+func (st *State) DeleteContainer(id string) {
+  st.update(id, func(s *shardState) bool {
+    s.deleteContainer(id)
+    return true
+  })
+}
+
+type keyedLock struct {
+  sync.Mutex
+  refs int
+}
+
+// KeyedMutex serializes operations on the same key, e.g. external
+// commands on the same sandbox, while letting others run in parallel
+type KeyedMutex struct {
+  mu sync.Mutex
+  locks map[string]*keyedLock
+}
+
+func (m *KeyedMutex) Lock(key string) {
+  m.mu.Lock()
+  if m.locks == nil {
+    m.locks = make(map[string]*keyedLock)
+  }
+  l, ok := m.locks[key]
+  if !ok {
+    l = &keyedLock{}
+    m.locks[key] = l
+  }
+  l.refs++
+  m.mu.Unlock()
+
+  l.Lock()
+}
+
+func (m *KeyedMutex) Unlock(key string) {
+  m.mu.Lock()
+  l := m.locks[key]
+  l.refs--
+  if l.refs == 0 {
+    delete(m.locks, key)
+  }
+  m.mu.Unlock()
+
+  l.Unlock()
+}
@@ -0,0 +1,132 @@
+package service
+
+import (
+  "fmt"
+  "io"
+  "os"
+  "os/exec"
+  "path/filepath"
+  "time"
+
+  "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+  kubecontainer "k8s.io/kubernetes/pkg/kubelet/container"
+  utilexec "k8s.io/kubernetes/pkg/util/exec"
+  "k8s.io/kubernetes/pkg/util/term"
+)
+
+// StreamingRuntime serves exec and attach of the CRI streaming server
+type StreamingRuntime struct {
+  Service *FakeRuntimeService
+}
+
+func wrapExitError(err error) error {
+  if exitErr, ok := err.(*exec.ExitError); ok {
+    return &utilexec.ExitErrorWrapper{ExitError: exitErr}
+  }
+  return err
+}
+
+// Exec runs cmd in container with unenter, same as NsenterExecHandler
+// of dockershim
+func (r *StreamingRuntime) Exec(containerID string, cmd []string, in io.Reader, out, errw io.WriteCloser, tty bool, resize <-chan term.Size) error {
+  command, err := r.Service.ExecCommand(containerID, cmd)
+  if err != nil {
+    return err
+  }
+
+  if !tty {
+    if in != nil {
+      command.Stdin = in
+    }
+    command.Stdout = out
+    command.Stderr = errw
+    return wrapExitError(command.Run())
+  }
+
+  p, err := kubecontainer.StartPty(command)
+  if err != nil {
+    return err
+  }
+  defer p.Close()
+
+  kubecontainer.HandleResizing(resize, func(size term.Size) {
+    term.SetSize(p.Fd(), size)
+  })
+
+  if in != nil {
+    go io.Copy(p, in)
+  }
+
+  if out != nil {
+    go io.Copy(out, p)
+  }
+
+  return wrapExitError(command.Wait())
+}
+
+// follow copies what is appended to file to w since offset
+func follow(file *os.File, w io.Writer) error {
+  if w == nil {
+    return nil
+  }
+  _, err := io.Copy(w, file)
+  return err
+}
+
+// Attach streams output of container, as appended to its .out and
+// .err files, until it exits. Containers are started with stdin from
+// /dev/null and without tty, so neither can be attached to.
+func (r *StreamingRuntime) Attach(containerID string, in io.Reader, out, errw io.WriteCloser, tty bool, resize <-chan term.Size) error {
+  if tty {
+    return fmt.Errorf("container %s has no tty", containerID)
+  }
+
+  s := r.Service
+  c, ok := s.State.Container(containerID)
+  if !ok {
+    return fmt.Errorf("container %s not found", containerID)
+  }
+
+  podDir := filepath.Join(*s.RootDir, "nodes", *s.Node, "pods", c.SandboxID)
+
+  stdout, err := os.Open(filepath.Join(podDir, containerID + ".out"))
+  if err != nil {
+    return err
+  }
+  defer stdout.Close()
+
+  stderr, err := os.Open(filepath.Join(podDir, containerID + ".err"))
+  if err != nil {
+    return err
+  }
+  defer stderr.Close()
+
+  if _, err := stdout.Seek(0, io.SeekEnd); err != nil {
+    return err
+  }
+  if _, err := stderr.Seek(0, io.SeekEnd); err != nil {
+    return err
+  }
+
+  for {
+    c, ok := s.State.Container(containerID)
+    running := ok && c.State == runtime.ContainerState_CONTAINER_RUNNING
+
+    if err := follow(stdout, out); err != nil {
+      return err
+    }
+    if err := follow(stderr, errw); err != nil {
+      return err
+    }
+
+    if !running {
+      return nil
+    }
+
+    time.Sleep(100 * time.Millisecond)
+  }
+}
+
+func (r *StreamingRuntime) PortForward(podSandboxID string, port int32, stream io.ReadWriteCloser) error {
+  return fmt.Errorf("port forward not supported")
+}
@@ -0,0 +1,134 @@
+package service
+
+import (
+  "bytes"
+  "encoding/binary"
+  "fmt"
+  "io/ioutil"
+  "os"
+  "sort"
+  "strings"
+  "time"
+
+  "github.com/golang/glog"
+)
+
+// format of records of unspawn --trace, see src/trace.h, in host byte
+// order, i.e. little endian on nodes fakecr runs on
+const (
+  traceMagic = 0x43525455
+  traceVersion = 1
+  traceKeyMax = 232
+)
+
+var tracePhases = map[uint16]string{
+  1: "start",
+  2: "netns",
+  3: "userns",
+  4: "cgroup",
+  5: "clone",
+  6: "child",
+  7: "setns",
+  8: "hostname",
+  9: "placement",
+  10: "exec-helper",
+  11: "register",
+  12: "continue",
+  13: "exec",
+  14: "lookup",
+  15: "context",
+  16: "enter",
+}
+
+// records of the child until it execs may be written after unspawn
+// daemon replied, the trace is read once they should all be there
+const traceDelay = time.Second
+
+type traceRecord struct {
+  Magic uint32
+  Version uint16
+  Phase uint16
+  Pid int32
+  Reserved uint32
+  Time int64
+  Key [traceKeyMax]byte
+}
+
+// Phase is how long one phase of starting a process took
+type Phase struct {
+  Name string
+  Duration time.Duration
+}
+
+type byTime []traceRecord
+
+func (r byTime) Len() int { return len(r) }
+func (r byTime) Swap(i, j int) { r[i], r[j] = r[j], r[i] }
+func (r byTime) Less(i, j int) bool { return r[i].Time < r[j].Time }
+
+// ReadTrace returns phases of each key traced to file at path, in the
+// order they ended. The first record of a key only marks the start.
+func ReadTrace(path string) (map[string][]Phase, error) {
+  data, err := ioutil.ReadFile(path)
+  if err != nil {
+    return nil, err
+  }
+
+  records := map[string][]traceRecord{}
+  r := bytes.NewReader(data)
+  for r.Len() > 0 {
+    var rec traceRecord
+    // a record partly written ends the trace
+    if err := binary.Read(r, binary.LittleEndian, &rec); err != nil {
+      break
+    }
+    if rec.Magic != traceMagic || rec.Version != traceVersion {
+      return nil, fmt.Errorf("%s: not a trace of version %d", path, traceVersion)
+    }
+    key := string(bytes.TrimRight(rec.Key[:], "\x00"))
+    records[key] = append(records[key], rec)
+  }
+
+  phases := map[string][]Phase{}
+  for key, recs := range records {
+    sort.Stable(byTime(recs))
+    for i := 1; i < len(recs); i++ {
+      name, ok := tracePhases[recs[i].Phase]
+      if !ok {
+        name = fmt.Sprintf("phase%d", recs[i].Phase)
+      }
+      phases[key] = append(phases[key], Phase{name, time.Duration(recs[i].Time - recs[i-1].Time)})
+    }
+  }
+  return phases, nil
+}
+
+// reportTrace logs startup breakdown of container, waited queued for
+// its turn to spawn, and observes its phases in metrics. The trace is
+// removed afterwards, it is not needed once the container started.
+func reportTrace(containerID string, path string, queued time.Duration) {
+  defer os.Remove(path)
+
+  traces, err := ReadTrace(path)
+  if err != nil {
+    glog.Warningf("read trace of container %s: %v", containerID, err)
+    return
+  }
+
+  phases := []Phase{{"queued", queued}}
+  for _, trace := range traces {
+    phases = append(phases, trace...)
+  }
+
+  total := time.Duration(0)
+  parts := []string{}
+  for _, phase := range phases {
+    metrics.observe(metrics.phases, phase.Name, phase.Duration, nil)
+    total += phase.Duration
+    parts = append(parts, fmt.Sprintf("%s %s", phase.Name, phase.Duration))
+  }
+
+  if glog.V(2) {
+    glog.Infof("container %s started in %s: %s", containerID, total, strings.Join(parts, ", "))
+  }
+}
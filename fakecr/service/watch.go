@@ -0,0 +1,114 @@
+package service
+
+import (
+  "fmt"
+  "io/ioutil"
+  "net"
+  "path/filepath"
+  "strings"
+  "sync/atomic"
+  "time"
+
+  "github.com/golang/glog"
+  "k8s.io/kubernetes/pkg/kubelet/api/v1alpha1/runtime"
+)
+
+// Exited marks container exited with exit code and finish time in
+// nanoseconds, as recorded by unspawn --exit-status.
+func (s *FakeRuntimeService) Exited(containerID string, code int32, finishedAt int64) {
+  s.exited(containerID, func(c *FakeContainer) bool {
+    c.State = runtime.ContainerState_CONTAINER_EXITED
+    c.ExitCode = code
+    c.FinishedAt = time.Unix(0, finishedAt).Unix()
+    return true
+  })
+}
+
+func (s *FakeRuntimeService) exited(containerID string, f func(c *FakeContainer) bool) {
+  if s.State.UpdateContainer(containerID, f) && s.Cpus != nil {
+    s.Cpus.Release(containerID)
+  }
+}
+
+// ReadExitStatus marks container exited, with exit code and finish
+// time from its exit status file if there is one, unless it has been
+// marked otherwise since c was loaded.
+func (s *FakeRuntimeService) ReadExitStatus(c *FakeContainer) {
+  path := filepath.Join("/run/containers", *s.Node, c.SandboxID, c.Id + ".exit")
+
+  var code, sig int32
+  var finishedAt int64
+
+  data, err := ioutil.ReadFile(path)
+  if err == nil {
+    _, err = fmt.Sscanf(string(data), "%d %d %d", &code, &sig, &finishedAt)
+  }
+
+  s.exited(c.Id, func(c *FakeContainer) bool {
+    if c.State != runtime.ContainerState_CONTAINER_RUNNING {
+      return false
+    }
+    c.State = runtime.ContainerState_CONTAINER_EXITED
+    if err == nil {
+      c.ExitCode = code
+      c.FinishedAt = time.Unix(0, finishedAt).Unix()
+    }
+    return true
+  })
+}
+
+// Watch receives exit events from unspawn daemon, so that containers
+// are marked exited the moment they die, and ListContainers no longer
+// has to check them.
+func (s *FakeRuntimeService) Watch() {
+  for {
+    if err := s.watch(); err != nil {
+      glog.Errorf("watch %s: %v", *s.Unspawnd, err)
+    }
+
+    atomic.StoreInt32(&s.Watching, 0)
+
+    time.Sleep(time.Second)
+  }
+}
+
+func (s *FakeRuntimeService) watch() error {
+  conn, err := net.DialUnix("unixpacket", nil, &net.UnixAddr{Name: *s.Unspawnd, Net: "unixpacket"})
+  if err != nil {
+    return err
+  }
+  defer conn.Close()
+
+  if _, err := conn.Write([]byte("--watch\x00")); err != nil {
+    return err
+  }
+
+  buf := make([]byte, 65536)
+  if _, err := conn.Read(buf); err != nil {
+    return err
+  }
+
+  // containers exited before we started watching
+  s.CheckStates()
+  atomic.StoreInt32(&s.Watching, 1)
+
+  for {
+    n, err := conn.Read(buf)
+    if err != nil {
+      return err
+    }
+
+    var code, sig int32
+    var finishedAt int64
+    var pidfile string
+
+    if _, err := fmt.Sscanf(string(buf[:n]), "%d %d %d %s", &code, &sig, &finishedAt, &pidfile); err != nil {
+      glog.Errorf("bad exit event %q: %v", buf[:n], err)
+      continue
+    }
+
+    containerID := strings.TrimSuffix(filepath.Base(pidfile), ".pid")
+
+    s.Exited(containerID, code, finishedAt)
+  }
+}
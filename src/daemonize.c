@@ -34,19 +34,96 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <libgen.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
 #include <getopt.h>
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#define OPT_NOTIFY_FD 0
+#define OPT_WAIT_FILE 1
+#define OPT_WAIT_PORT 2
+#define OPT_TIMEOUT   3
+#define OPT_LISTEN    4
+#define OPT_CONNECT   5
+#define OPT_AFTER     6
+#define OPT_STATUS    7
+#define OPT_STOP      8
+
+// interval between two attempts to connect to --wait-port, and how
+// long an attempt is left pending, before it is started over
+#define PROBE_INTERVAL_MS 10
+#define PROBE_TIMEOUT_MS  1000
+
+// services a supervisor manages, services one is started after, and
+// clients waiting for one to be ready
+#define MAX_SERVICES 64
+#define MAX_AFTER    8
+#define MAX_WAITERS  8
+
+// a service is restarted after BACKOFF_MIN_MS once exited, doubled on
+// each exit up to BACKOFF_MAX_MS, unless it had been ready for STABLE_MS
+#define BACKOFF_MIN_MS 100
+#define BACKOFF_MAX_MS 30000
+#define STABLE_MS      10000
+
+// process group of a service stopped is killed with SIGKILL, if still
+// running STOP_GRACE_MS after SIGTERM
+#define STOP_GRACE_MS  10000
+
+#define EVENT_CLIENT 0
+#define EVENT_NOTIFY 1
+#define EVENT_PROBE  2
+
 static char *executable = NULL;
 static char* opt_stdout = NULL;
 static char* opt_stderr = NULL;
+static int opt_notify_fd = -1;
+static char *opt_wait_file = NULL;
+static char *opt_wait_port = NULL;
+static long opt_timeout = 30;
+static char *opt_listen = NULL;
+static char *opt_connect = NULL;
+static char *opt_name = NULL;
+static char *opt_after[MAX_AFTER] = {NULL};
+static size_t opt_nafter = 0;
+static int opt_status = 0;
+static int opt_stop = 0;
+static int opt_help = 0;
 
 
 static struct option options[] = {
   {"stdout",       required_argument, NULL, 'o'},
   {"stderr",       required_argument, NULL, 'e'},
+  {"notify-fd",    required_argument, NULL, OPT_NOTIFY_FD},
+  {"wait-file",    required_argument, NULL, OPT_WAIT_FILE},
+  {"wait-port",    required_argument, NULL, OPT_WAIT_PORT},
+  {"timeout",      required_argument, NULL, OPT_TIMEOUT},
+  {"listen",       required_argument, NULL, OPT_LISTEN},
+  {"connect",      required_argument, NULL, OPT_CONNECT},
+  {"name",         required_argument, NULL, 'n'},
+  {"after",        required_argument, NULL, OPT_AFTER},
+  {"status",       no_argument,       NULL, OPT_STATUS},
+  {"stop",         no_argument,       NULL, OPT_STOP},
   {"help",         no_argument,       NULL, 'h'},
   {NULL,           no_argument,       NULL, 0}
 };
@@ -58,6 +135,33 @@ show_usage() {
   printf("\n"
          "  -o, --stdout=STDOUT        standard output\n"
          "  -e, --stderr=STDERR        standard error\n"
+         "      --notify-fd=FD         pass FD to command, also as NOTIFY_FD in its\n"
+         "                             environment, and wait for it to write to FD\n"
+         "      --wait-file=FILE       wait for FILE, e.g. a socket, to exist\n"
+         "      --wait-port=HOST:PORT  wait for HOST to accept connections on PORT\n"
+         "      --timeout=SECONDS      give up waiting after SECONDS, default 30,\n"
+         "                             0 for no limit\n"
+         "\n"
+         "With any of --notify-fd, --wait-file and --wait-port, exit once all\n"
+         "of them are ready, instead of right after command is started. Without\n"
+         "command, only wait for FILE or PORT.\n"
+         "\n"
+         "      --listen=SOCKET        instead of command, run a supervisor of\n"
+         "                             services listening on SOCKET\n"
+         "      --connect=SOCKET       ask supervisor listening on SOCKET to run\n"
+         "                             command as service --name\n"
+         "  -n, --name=NAME            name of service\n"
+         "      --after=NAME           start only once service NAME is ready, may\n"
+         "                             be given up to 8 times\n"
+         "      --status               print state of each service, or of --name\n"
+         "      --stop                 stop service --name, and its restarts,\n"
+         "                             killed if not exited in 10 seconds\n"
+         "\n"
+         "A service is restarted each time it exits, after a delay doubled\n"
+         "each time, from 0.1 up to 30 seconds. Its standard output and error\n"
+         "are appended to, and it runs with environment of daemonize. With\n"
+         "--connect, exit once the service is ready, and a name already\n"
+         "supervised is not started again.\n"
          "\n"
          "  -h, --help                 print help message and exit\n"
          );
@@ -65,19 +169,292 @@ show_usage() {
 }
 
 
+void
+cleanup_fd(int *fd) {
+  if (*fd < 0)
+    return;
+  close(*fd);
+}
+
+
+void
+cleanup_addrinfo(struct addrinfo **ai) {
+  if (!*ai)
+    return;
+  freeaddrinfo(*ai);
+}
+
+
+int64_t
+now_ms() {
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// returns the earlier of timeout, -1 if none, and ms from now
 int
-main(int argc, char *const argv[]) {
-  executable = argv[0];
+earlier(int timeout, int64_t ms) {
+  if (ms < 0) {
+    ms = 0;
+  }
+
+  return ((timeout < 0) || (ms < timeout))?(int)ms:timeout;
+}
+
+
+// resolves HOST:PORT of --wait-port
+int
+resolve_port(const char *spec, struct addrinfo **ai) {
+  char host[256] = {0};
+  const char *port = strrchr(spec, ':');
+  if (!port || ((size_t)(port - spec) >= sizeof(host))) {
+    fprintf(stderr, "error: invalid port '%s', expect HOST:PORT\n", spec);
+    return -1;
+  }
+  memcpy(host, spec, port - spec);
+
+  struct addrinfo hints = {
+    .ai_family = AF_UNSPEC,
+    .ai_socktype = SOCK_STREAM,
+  };
+
+  int err = getaddrinfo(host, port + 1, &hints, ai);
+  if (err != 0) {
+    fprintf(stderr, "error: resolve '%s', %s\n", spec, gai_strerror(err));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+// starts connecting to addr without blocking, returns fd while
+// connecting, or -1 with *connected set if it is done already
+int
+start_probe(const struct addrinfo *ai, int *connected) {
+  *connected = 0;
+
+  int fd = socket(ai->ai_family, ai->ai_socktype|SOCK_NONBLOCK|SOCK_CLOEXEC, ai->ai_protocol);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+    *connected = 1;
+  } else if (errno == EINPROGRESS) {
+    return fd;
+  }
+
+  close(fd);
+  return -1;
+}
+
+
+// returns 1 if connect of fd succeeded, once fd is writable
+int
+probe_connected(int fd) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+    return 0;
+  }
+
+  return err == 0;
+}
+
+
+// watches directory of --wait-file for it to be created, returns -1 if
+// directory does not exist yet, then existence of file is polled
+int
+watch_file(const char *path) {
+  char dir[PATH_MAX] = {0};
+  strncpy(dir, path, PATH_MAX - 1);
+
+  int fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (inotify_add_watch(fd, dirname(dir), IN_CREATE|IN_MOVED_TO|IN_ATTRIB) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+// waits until each of notify, --wait-file and --wait-port is ready,
+// returns -1 on timeout, if command closed notify without writing, or
+// if pidfd of command becomes readable, i.e. it exited
+int
+wait_ready(int notify, int pidfd) {
+  struct addrinfo *ai __attribute__((cleanup(cleanup_addrinfo))) = NULL;
+  if (opt_wait_port && (resolve_port(opt_wait_port, &ai) != 0)) {
+    return -1;
+  }
+
+  int inotify __attribute__((cleanup(cleanup_fd))) = opt_wait_file?watch_file(opt_wait_file):-1;
+  int probe __attribute__((cleanup(cleanup_fd))) = -1;
+
+  int notified = (notify < 0);
+  int file_ready = !opt_wait_file;
+  int port_ready = !opt_wait_port;
+  int64_t probe_ms = 0;
+  int64_t deadline = now_ms() + opt_timeout * 1000;
+
+  for(;;) {
+    if (!file_ready) {
+      file_ready = (access(opt_wait_file, F_OK) == 0);
+    }
+
+    int64_t now = now_ms();
+
+    if ((!port_ready) && (probe >= 0) && (probe_ms <= now)) {
+      close(probe);
+      probe = -1;
+    }
+
+    if ((!port_ready) && (probe < 0) && (probe_ms <= now)) {
+      probe = start_probe(ai, &port_ready);
+      probe_ms = now + ((probe < 0)?PROBE_INTERVAL_MS:PROBE_TIMEOUT_MS);
+    }
+
+    if (notified && file_ready && port_ready) {
+      return 0;
+    }
+
+    int64_t remaining = (opt_timeout > 0)?(deadline - now):INT32_MAX;
+    if (remaining <= 0) {
+      fprintf(stderr, "error: not ready in %ld seconds\n", opt_timeout);
+      return -1;
+    }
+
+    // file is polled every PROBE_INTERVAL_MS if its directory is not
+    // watched, port is connected to without blocking, so that notify
+    // and pidfd are never held up
+    int timeout = remaining;
+    if ((!file_ready) && (inotify < 0)) {
+      timeout = earlier(timeout, PROBE_INTERVAL_MS);
+    }
+
+    if (!port_ready) {
+      timeout = earlier(timeout, probe_ms - now);
+    }
+
+    struct pollfd fds[4] = {
+      {.fd = notified?-1:notify, .events = POLLIN},
+      {.fd = file_ready?-1:inotify, .events = POLLIN},
+      {.fd = pidfd, .events = POLLIN},
+      {.fd = port_ready?-1:probe, .events = POLLOUT},
+    };
+
+    if ((poll(fds, 4, timeout) < 0) && (errno != EINTR)) {
+      fprintf(stderr, "error: poll, %m\n");
+      return -1;
+    }
+
+    if (fds[0].revents) {
+      char buf[64];
+      ssize_t n = read(notify, buf, sizeof(buf));
+      if (n == 0) {
+        fprintf(stderr, "error: exited, or closed notify fd, before ready\n");
+        return -1;
+      }
+      notified = (n > 0);
+    }
+
+    if (fds[1].revents) {
+      char buf[4096];
+      while (read(inotify, buf, sizeof(buf)) > 0);
+    }
+
+    if (fds[2].revents) {
+      fprintf(stderr, "error: exited before ready\n");
+      return -1;
+    }
+
+    if (fds[3].revents) {
+      port_ready = probe_connected(probe);
+      close(probe);
+      probe = -1;
+      probe_ms = now_ms() + (port_ready?0:PROBE_INTERVAL_MS);
+    }
+  }
+}
+
+
+// opens path as fd, name is what it is in error messages
+int
+redirect(int fd, const char *path, int flags, const char *name) {
+  int f = open(path, flags, S_IRUSR|S_IWUSR);
+  if (f < 0) {
+    fprintf(stderr, "error: failed to open %s, %m\n", name);
+    return -1;
+  }
+
+  if (dup2(f, fd) < 0) {
+    fprintf(stderr, "error: failed to dup %s, %m\n", name);
+    close(f);
+    return -1;
+  }
+
+  close(f);
+  return 0;
+}
+
+
+// passes write end of notify pipe to command as fd
+int
+pass_notify_fd(int notify, int fd) {
+  char value[16] = {0};
+  snprintf(value, sizeof(value), "%d", fd);
+
+  if (notify == fd) {
+    fcntl(notify, F_SETFD, 0);
+  } else if (dup2(notify, fd) < 0) {
+    fprintf(stderr, "error: failed to dup notify fd, %m\n");
+    return -1;
+  }
+
+  if (setenv("NOTIFY_FD", value, 1) != 0) {
+    fprintf(stderr, "error: failed to set NOTIFY_FD, %m\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int
+parse_options(int argc, char *const argv[]) {
+  opt_stdout = NULL;
+  opt_stderr = NULL;
+  opt_notify_fd = -1;
+  opt_wait_file = NULL;
+  opt_wait_port = NULL;
+  opt_timeout = 30;
+  opt_listen = NULL;
+  opt_connect = NULL;
+  opt_name = NULL;
+  opt_nafter = 0;
+  opt_status = 0;
+  opt_stop = 0;
+  opt_help = 0;
+  optind = 0;
 
   int opt, index;
+  char *end;
 
-  while((opt = getopt_long(argc, argv, "+e:o:h", options, &index)) != -1) {
+  while((opt = getopt_long(argc, argv, "+e:o:n:h", options, &index)) != -1) {
     switch(opt) {
     case '?':
-      goto argument;
+      return -1;
 
     case 'h':
-      show_usage();
+      opt_help = 1;
       break;
 
     case 'o':
@@ -88,102 +465,1157 @@ main(int argc, char *const argv[]) {
       opt_stderr = optarg;
       break;
 
+    case 'n':
+      opt_name = optarg;
+      break;
+
+    case OPT_NOTIFY_FD:
+      opt_notify_fd = strtol(optarg, &end, 10);
+      if ((*end != '\0') || (opt_notify_fd <= STDERR_FILENO)) {
+        fprintf(stderr, "error: invalid notify fd '%s'\n", optarg);
+        return -1;
+      }
+      break;
+
+    case OPT_WAIT_FILE:
+      opt_wait_file = optarg;
+      break;
+
+    case OPT_WAIT_PORT:
+      opt_wait_port = optarg;
+      break;
+
+    case OPT_TIMEOUT:
+      opt_timeout = strtol(optarg, &end, 10);
+      if ((*end != '\0') || (opt_timeout < 0)) {
+        fprintf(stderr, "error: invalid timeout '%s'\n", optarg);
+        return -1;
+      }
+      break;
+
+    case OPT_LISTEN:
+      opt_listen = optarg;
+      break;
+
+    case OPT_CONNECT:
+      opt_connect = optarg;
+      break;
+
+    case OPT_AFTER:
+      if (opt_nafter == MAX_AFTER) {
+        fprintf(stderr, "error: more than %d services to start after\n", MAX_AFTER);
+        return -1;
+      }
+      opt_after[opt_nafter++] = optarg;
+      break;
+
+    case OPT_STATUS:
+      opt_status = 1;
+      break;
+
+    case OPT_STOP:
+      opt_stop = 1;
+      break;
+
     default:
       break;
     }
   }
 
+  return 0;
+}
+
 
-  {
-    pid_t pid = fork();
-    if (pid < 0) {
-      fprintf(stderr, "error: failed to fork, %m\n");
-      return EXIT_FAILURE;
+#define STATE_WAITING  0
+#define STATE_STARTING 1
+#define STATE_READY    2
+#define STATE_BACKOFF  3
+#define STATE_STOPPED  4
+
+static const char *const state_names[] = {"waiting", "starting", "ready", "backoff", "stopped"};
+
+// options of a service point into its request, kept as long as it is
+// supervised
+struct service {
+  char *request;
+  char **argv;
+  char **envp;
+  char *const *command;
+  const char *name;
+  const char *stdout_path;
+  const char *stderr_path;
+  const char *wait_file;
+  struct addrinfo *wait_port;
+  int notify_fd;
+  const char *after[MAX_AFTER];
+  size_t nafter;
+
+  int state;
+  int64_t since_ms;
+  pid_t pid;
+  int notify;
+  int notified;
+  int probe;
+  int port_ready;
+  int64_t probe_ms;
+  int killed;
+  unsigned restarts;
+  int64_t backoff_ms;
+  int64_t start_ms;
+  int waiters[MAX_WAITERS];
+  size_t nwaiters;
+};
+
+static struct service services[MAX_SERVICES];
+static size_t nservices = 0;
+static int epoll_fd = -1;
+
+
+int
+epoll_add(int efd, int fd, uint32_t kind, uint32_t events) {
+  struct epoll_event event = {
+    .events = events,
+    .data.u64 = ((uint64_t)kind << 32) | (uint32_t)fd,
+  };
+
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &event) != 0) {
+    fprintf(stderr, "error: epoll_ctl, %m\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+struct service *
+find_service(const char *name) {
+  for(size_t i=0; i<nservices; i++) {
+    if (strcmp(services[i].name, name) == 0) {
+      return services + i;
     }
+  }
 
-    if (pid > 0) {
-      _exit(0);
+  return NULL;
+}
+
+
+void
+set_state(struct service *s, int state) {
+  s->state = state;
+  s->since_ms = now_ms();
+}
+
+
+int
+send_reply(int fd, const char *reply) {
+  ssize_t n = strlen(reply);
+  if (send(fd, reply, n, MSG_NOSIGNAL) != n) {
+    fprintf(stderr, "error: send reply, %m\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int
+reply_pid(int fd, pid_t pid) {
+  char reply[16] = {0};
+  snprintf(reply, sizeof(reply), "%d", pid);
+  return send_reply(fd, reply);
+}
+
+
+// replies pid to clients waiting for service, a client closed is
+// removed once its connection is
+void
+answer(struct service *s, pid_t pid) {
+  for(size_t i=0; i<s->nwaiters; i++) {
+    reply_pid(s->waiters[i], pid);
+  }
+
+  s->nwaiters = 0;
+}
+
+
+void
+forget_waiter(int fd) {
+  for(size_t i=0; i<nservices; i++) {
+    struct service *s = services + i;
+    for(size_t j=s->nwaiters; j>0; j--) {
+      if (s->waiters[j-1] == fd) {
+        s->waiters[j-1] = s->waiters[--s->nwaiters];
+      }
     }
+  }
+}
+
 
+int
+add_waiter(struct service *s, int fd) {
+  if (s->nwaiters == MAX_WAITERS) {
+    fprintf(stderr, "error: too many clients waiting for service '%s'\n", s->name);
+    return -1;
   }
 
+  s->waiters[s->nwaiters++] = fd;
+  return 0;
+}
+
+
+// runs in the child forked for service, never returns
+void
+exec_service(const struct service *s, int notify, const sigset_t *oldset) {
+  sigprocmask(SIG_SETMASK, oldset, NULL);
+
   if (setsid() < 0) {
     fprintf(stderr, "error: failed to setsid, %m\n");
-    return EXIT_FAILURE;
+    _exit(EXIT_FAILURE);
   }
 
-  {
-    pid_t pid = fork();
-    if (pid < 0) {
-      fprintf(stderr, "error: failed to fork again, %m\n");
-      return EXIT_FAILURE;
-    }
+  if ((redirect(STDIN_FILENO, "/dev/null", O_RDONLY, "stdin") != 0) ||
+      (redirect(STDOUT_FILENO, s->stdout_path?s->stdout_path:"/dev/null", O_CREAT|O_WRONLY|O_APPEND, "stdout") != 0) ||
+      (redirect(STDERR_FILENO, s->stderr_path?s->stderr_path:"/dev/null", O_CREAT|O_WRONLY|O_APPEND, "stderr") != 0)) {
+    _exit(EXIT_FAILURE);
+  }
 
-    if (pid > 0) {
-      _exit(0);
-    }
+  clearenv();
+  for(char **env = s->envp; *env; env++) {
+    putenv(*env);
+  }
 
+  if ((notify >= 0) && (pass_notify_fd(notify, s->notify_fd) != 0)) {
+    _exit(EXIT_FAILURE);
   }
 
-  umask(0);
+  execvp(s->command[0], s->command);
+  fprintf(stderr, "error: exec, %m\n");
+  _exit(EXIT_FAILURE);
+}
 
-  {
-    int fd = open("/dev/null", O_RDONLY);
-    if (fd < 0) {
-      fprintf(stderr, "error: failed to open stdin, %m\n");
-      return EXIT_FAILURE;
+
+void
+schedule_restart(struct service *s) {
+  s->start_ms = now_ms() + s->backoff_ms;
+  s->backoff_ms = (s->backoff_ms * 2 < BACKOFF_MAX_MS)?(s->backoff_ms * 2):BACKOFF_MAX_MS;
+  s->restarts++;
+  set_state(s, STATE_BACKOFF);
+}
+
+
+void
+start_service(struct service *s, const sigset_t *oldset) {
+  int notify[2] = {-1, -1};
+  if ((s->notify_fd >= 0) && (pipe2(notify, O_CLOEXEC) != 0)) {
+    fprintf(stderr, "error: failed to create notify pipe of '%s', %m\n", s->name);
+    schedule_restart(s);
+    return;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "error: failed to fork '%s', %m\n", s->name);
+    if (notify[0] >= 0) {
+      close(notify[0]);
+      close(notify[1]);
     }
+    schedule_restart(s);
+    return;
+  }
 
-    if (dup2(fd, 0) < 0) {
-      fprintf(stderr, "error: failed to dup stdin, %m\n");
-      close(fd);
-      return EXIT_FAILURE;
+  if (pid == 0) {
+    if (notify[0] >= 0) {
+      close(notify[0]);
     }
+    exec_service(s, notify[1], oldset);
+  }
 
-    close(fd);
+  if (notify[1] >= 0) {
+    close(notify[1]);
   }
 
+  s->pid = pid;
+  s->notify = notify[0];
+  s->notified = (notify[0] < 0);
+  s->port_ready = !s->wait_port;
+  s->probe_ms = 0;
 
-  {
-    int fd = open(opt_stdout, O_CREAT|O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR);
-    if (fd < 0) {
-      fprintf(stderr, "error: failed to open stdout, %m\n");
-      return EXIT_FAILURE;
-    }
+  if ((s->notify >= 0) && (epoll_add(epoll_fd, s->notify, EVENT_NOTIFY, EPOLLIN) != 0)) {
+    close(s->notify);
+    s->notify = -1;
+  }
 
-    if (dup2(fd, 1) < 0) {
-      fprintf(stderr, "error: failed to dup stdout, %m\n");
-      close(fd);
-      return EXIT_FAILURE;
-    }
+  fprintf(stderr, "service '%s' started, pid %d\n", s->name, pid);
+  set_state(s, STATE_STARTING);
+}
 
-    close(fd);
+
+void
+close_notify(struct service *s) {
+  if (s->notify < 0) {
+    return;
   }
 
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->notify, NULL);
+  close(s->notify);
+  s->notify = -1;
+}
 
-  {
-    int fd = open(opt_stderr, O_CREAT|O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR);
-    if (fd < 0) {
-      fprintf(stderr, "error: failed to open stderr, %m\n");
-      return EXIT_FAILURE;
-    }
 
-    if (dup2(fd, 2) < 0) {
-      fprintf(stderr, "error: failed to dup stderr, %m\n");
-      close(fd);
-      return EXIT_FAILURE;
+void
+close_probe(struct service *s) {
+  if (s->probe < 0) {
+    return;
+  }
+
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->probe, NULL);
+  close(s->probe);
+  s->probe = -1;
+}
+
+
+// connects to port of service without blocking, the socket is watched
+// for EPOLLOUT, and an attempt is started over after PROBE_TIMEOUT_MS
+// if pending, or PROBE_INTERVAL_MS if failed
+void
+probe_service(struct service *s, int64_t now) {
+  if (s->port_ready || (s->probe_ms > now)) {
+    return;
+  }
+
+  close_probe(s);
+  s->probe = start_probe(s->wait_port, &s->port_ready);
+  if ((s->probe >= 0) && (epoll_add(epoll_fd, s->probe, EVENT_PROBE, EPOLLOUT) != 0)) {
+    close(s->probe);
+    s->probe = -1;
+  }
+  s->probe_ms = now + ((s->probe < 0)?PROBE_INTERVAL_MS:PROBE_TIMEOUT_MS);
+}
+
+
+void
+service_probed(int fd) {
+  for(size_t i=0; i<nservices; i++) {
+    struct service *s = services + i;
+    if (s->probe != fd) {
+      continue;
     }
 
-    close(fd);
+    s->port_ready = probe_connected(fd);
+    close_probe(s);
+    s->probe_ms = now_ms() + (s->port_ready?0:PROBE_INTERVAL_MS);
+    return;
+  }
+}
+
+
+// a service is ready once notified, and its file and port are ready
+int
+check_ready(const struct service *s) {
+  if (!s->notified) {
+    return 0;
   }
 
+  if (s->wait_file && (access(s->wait_file, F_OK) != 0)) {
+    return 0;
+  }
 
-  if(optind < argc) {
-    execvp(argv[optind], argv + optind);
-    fprintf(stderr, "error: exec, %m\n");
-    exit(EXIT_FAILURE);
+  if (!s->port_ready) {
+    return 0;
   }
 
+  return 1;
+}
+
+
+int
+after_ready(const struct service *s) {
+  for(size_t i=0; i<s->nafter; i++) {
+    struct service *after = find_service(s->after[i]);
+    if ((!after) || (after->state != STATE_READY)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+// starts services due, and checks those starting, until none of them
+// changes state, so that services are started as soon as those they
+// are after are ready. returns timeout of the next check, -1 if none
+int
+schedule(const sigset_t *oldset) {
+  int timeout = -1;
+  int changed;
+
+  do {
+    changed = 0;
+    int64_t now = now_ms();
+
+    for(size_t i=0; i<nservices; i++) {
+      struct service *s = services + i;
+
+      switch(s->state) {
+      case STATE_WAITING:
+      case STATE_BACKOFF:
+        if (s->start_ms > now) {
+          timeout = earlier(timeout, s->start_ms - now);
+        } else if (!after_ready(s)) {
+          if (s->state != STATE_WAITING) {
+            set_state(s, STATE_WAITING);
+          }
+        } else {
+          start_service(s, oldset);
+          changed = 1;
+        }
+        break;
+
+      case STATE_STARTING:
+        probe_service(s, now);
+
+        if (check_ready(s)) {
+          close_notify(s);
+          close_probe(s);
+          set_state(s, STATE_READY);
+          fprintf(stderr, "service '%s' ready\n", s->name);
+          answer(s, s->pid);
+          changed = 1;
+          break;
+        }
+
+        if (s->wait_file) {
+          timeout = earlier(timeout, PROBE_INTERVAL_MS);
+        }
+
+        if (!s->port_ready) {
+          timeout = earlier(timeout, s->probe_ms - now);
+        }
+        break;
+
+      case STATE_STOPPED:
+        if ((s->pid <= 0) || s->killed) {
+          break;
+        } else if (s->since_ms + STOP_GRACE_MS > now) {
+          timeout = earlier(timeout, s->since_ms + STOP_GRACE_MS - now);
+        } else {
+          fprintf(stderr, "service '%s' not exited in %d ms, killing\n", s->name, STOP_GRACE_MS);
+          kill(-s->pid, SIGKILL);
+          s->killed = 1;
+        }
+        break;
+
+      default:
+        break;
+      }
+    }
+  } while(changed);
+
+  return timeout;
+}
+
+
+void
+service_notified(int fd) {
+  for(size_t i=0; i<nservices; i++) {
+    struct service *s = services + i;
+    if (s->notify != fd) {
+      continue;
+    }
+
+    char buf[64];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n == 0) {
+      fprintf(stderr, "service '%s' closed notify fd before ready\n", s->name);
+    }
+
+    s->notified = (n > 0);
+    if (n >= 0) {
+      close_notify(s);
+    }
+    return;
+  }
+}
+
+
+void
+service_exited(struct service *s, int status) {
+  close_notify(s);
+  close_probe(s);
+  s->pid = 0;
+
+  if (WIFSIGNALED(status)) {
+    fprintf(stderr, "service '%s' killed by signal %d\n", s->name, WTERMSIG(status));
+  } else {
+    fprintf(stderr, "service '%s' exited with status %d\n", s->name, WEXITSTATUS(status));
+  }
+
+  if (s->state == STATE_STOPPED) {
+    answer(s, 0);
+    return;
+  }
+
+  if ((s->state == STATE_READY) && (now_ms() - s->since_ms >= STABLE_MS)) {
+    s->backoff_ms = BACKOFF_MIN_MS;
+  }
+
+  fprintf(stderr, "service '%s' restarting in %lld ms\n", s->name, (long long)s->backoff_ms);
+  schedule_restart(s);
+}
+
+
+void
+reap_children() {
+  for(;;) {
+    int status;
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+    if (pid <= 0) {
+      return;
+    }
+
+    for(size_t i=0; i<nservices; i++) {
+      if (services[i].pid == pid) {
+        service_exited(services + i, status);
+        break;
+      }
+    }
+  }
+}
+
+
+void
+free_service(struct service *s) {
+  if (s->wait_port) {
+    freeaddrinfo(s->wait_port);
+  }
+  free(s->argv);
+  free(s->request);
+}
+
+
+// replies once the service is ready, or right away if it is supervised
+// already. takes request and argv, if the service is added.
+int
+add_service(int fd, char **request, char ***argv, int argc, char **envp) {
+  if (opt_help || opt_listen) {
+    fprintf(stderr, "error: option not allowed in request\n");
+    return reply_pid(fd, -1);
+  }
+
+  if (!opt_name) {
+    fprintf(stderr, "error: missing name\n");
+    return reply_pid(fd, -1);
+  }
+
+  struct service *s = find_service(opt_name);
+  if (s && (s->state == STATE_READY)) {
+    return reply_pid(fd, s->pid);
+  }
+
+  if (s && (s->state != STATE_STOPPED)) {
+    return (add_waiter(s, fd) == 0)?0:reply_pid(fd, -1);
+  }
+
+  if (s && (s->pid > 0)) {
+    fprintf(stderr, "error: service '%s' not yet stopped\n", opt_name);
+    return reply_pid(fd, -1);
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "error: missing command of '%s'\n", opt_name);
+    return reply_pid(fd, -1);
+  }
+
+  if ((!s) && (nservices == MAX_SERVICES)) {
+    fprintf(stderr, "error: more than %d services\n", MAX_SERVICES);
+    return reply_pid(fd, -1);
+  }
+
+  struct addrinfo *ai = NULL;
+  if (opt_wait_port && (resolve_port(opt_wait_port, &ai) != 0)) {
+    return reply_pid(fd, -1);
+  }
+
+  if (s) {
+    free_service(s);
+  } else {
+    s = services + nservices++;
+  }
+
+  *s = (struct service){
+    .request = *request,
+    .argv = *argv,
+    .envp = envp,
+    .command = *argv + optind,
+    .name = opt_name,
+    .stdout_path = opt_stdout,
+    .stderr_path = opt_stderr,
+    .wait_file = opt_wait_file,
+    .wait_port = ai,
+    .notify_fd = opt_notify_fd,
+    .nafter = opt_nafter,
+    .notify = -1,
+    .probe = -1,
+    .backoff_ms = BACKOFF_MIN_MS,
+    .waiters = {fd},
+    .nwaiters = 1,
+  };
+  memcpy(s->after, opt_after, sizeof(opt_after));
+  set_state(s, STATE_WAITING);
+
+  *request = NULL;
+  *argv = NULL;
+  return 0;
+}
+
+
+// stops restarts of service, and terminates its process group, killed
+// by schedule after STOP_GRACE_MS, replies once it exited
+int
+stop_service(int fd) {
+  if (!opt_name) {
+    fprintf(stderr, "error: missing name\n");
+    return reply_pid(fd, -1);
+  }
+
+  struct service *s = find_service(opt_name);
+  if (!s) {
+    fprintf(stderr, "error: no service '%s'\n", opt_name);
+    return reply_pid(fd, -1);
+  }
+
+  if (s->state != STATE_STOPPED) {
+    answer(s, -1);
+    set_state(s, STATE_STOPPED);
+    s->killed = 0;
+  }
+
+  if (s->pid <= 0) {
+    return reply_pid(fd, 0);
+  }
+
+  kill(-s->pid, SIGTERM);
+  return (add_waiter(s, fd) == 0)?0:reply_pid(fd, -1);
+}
+
+
+// one line 'NAME<TAB>STATE<TAB>PID<TAB>RESTARTS<TAB>SECONDS' of each
+// service, after a header, seconds since it entered its state
+int
+send_status(int fd) {
+  char buf[65536];
+  int64_t now = now_ms();
+  size_t len = snprintf(buf, sizeof(buf), "NAME\tSTATE\tPID\tRESTARTS\tSECONDS\n");
+  int found = 0;
+
+  for(size_t i=0; i<nservices; i++) {
+    struct service *s = services + i;
+    if (opt_name && (strcmp(s->name, opt_name) != 0)) {
+      continue;
+    }
+
+    found = 1;
+    int n = snprintf(buf + len, sizeof(buf) - len, "%s\t%s\t%d\t%u\t%lld\n", s->name, state_names[s->state], s->pid, s->restarts, (long long)((now - s->since_ms) / 1000));
+    if ((n < 0) || ((size_t)n >= sizeof(buf) - len)) {
+      break;
+    }
+    len += n;
+  }
+
+  if (opt_name && (!found)) {
+    return reply_pid(fd, -1);
+  }
+
+  return send_reply(fd, buf);
+}
+
+
+// a request is a single SOCK_SEQPACKET message, its payload are the
+// number of arguments in decimal, the arguments of daemonize, and then
+// its environment, each terminated by NUL. argv is followed by envp in
+// the same array, allocated with malloc.
+char **
+split_request(char *buf, size_t len, int *argc, char ***envp) {
+  size_t n = 0;
+  for(size_t i=0; i<len; i++) {
+    n += (buf[i] == '\0');
+  }
+
+  char *end;
+  long count = -1;
+  if ((len > 0) && (buf[len-1] == '\0')) {
+    count = strtol(buf, &end, 10);
+  }
+
+  if ((count < 0) || (*end != '\0') || ((size_t)count >= n)) {
+    fprintf(stderr, "error: invalid request\n");
+    return NULL;
+  }
+
+  char **argv = calloc(n + 2, sizeof(char *));
+  if (!argv) {
+    fprintf(stderr, "error: calloc, %m\n");
+    return NULL;
+  }
+
+  size_t k = 0;
+  size_t i = strlen(buf) + 1;
+
+  argv[k++] = executable;
+  for(long j=0; j<count; j++, i += strlen(buf+i)+1) {
+    argv[k++] = buf + i;
+  }
+  argv[k++] = NULL;
+
+  *envp = argv + k;
+  for(; i<len; i += strlen(buf+i)+1) {
+    argv[k++] = buf + i;
+  }
+  argv[k] = NULL;
+
+  *argc = count + 1;
+  return argv;
+}
+
+
+// the reply is the pid of the service once ready, 0 once stopped, -1
+// on failure, or its status
+int
+handle_request(int fd) {
+  char buf[65536];
+  ssize_t len = recv(fd, buf, sizeof(buf), MSG_TRUNC);
+  if (len < 0) {
+    fprintf(stderr, "error: recv, %m\n");
+    return -1;
+  }
+
+  if (len == 0) {
+    return 0;
+  }
+
+  if ((size_t)len > sizeof(buf)) {
+    fprintf(stderr, "error: request truncated\n");
+    return (reply_pid(fd, -1) == 0)?1:-1;
+  }
+
+  char *request = malloc(len);
+  if (!request) {
+    fprintf(stderr, "error: malloc, %m\n");
+    return (reply_pid(fd, -1) == 0)?1:-1;
+  }
+  memcpy(request, buf, len);
+
+  int argc;
+  char **envp;
+  char **argv = split_request(request, len, &argc, &envp);
+
+  int result;
+  if ((!argv) || (parse_options(argc, argv) != 0)) {
+    result = reply_pid(fd, -1);
+  } else if (opt_status) {
+    result = send_status(fd);
+  } else if (opt_stop) {
+    result = stop_service(fd);
+  } else {
+    result = add_service(fd, &request, &argv, argc, envp);
+  }
+
+  free(argv);
+  free(request);
+  return (result == 0)?1:-1;
+}
+
+
+int
+listen_socket(const char *path) {
+  struct sockaddr_un addr = {
+    .sun_family = AF_UNIX,
+  };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: socket path too long '%s'\n", path);
+    return -1;
+  }
+
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "error: socket, %m\n");
+    return -1;
+  }
+
+  if ((unlink(path) != 0) && (errno != ENOENT)) {
+    fprintf(stderr, "error: unlink '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "error: bind '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  if (listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "error: listen '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+int
+serve(const char *path) {
+  sigset_t set, oldset;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+
+  if(sigprocmask(SIG_BLOCK, &set, &oldset) != 0) {
+    fprintf(stderr, "set signal mask, %m\n");
+    return -1;
+  }
+
+  int sfd __attribute__((cleanup(cleanup_fd))) = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC);
+  if (sfd < 0) {
+    fprintf(stderr, "error: create signalfd, %m\n");
+    return -1;
+  }
+
+  int lfd __attribute__((cleanup(cleanup_fd))) = listen_socket(path);
+  if (lfd < 0) {
+    return -1;
+  }
+
+  int efd __attribute__((cleanup(cleanup_fd))) = epoll_create1(EPOLL_CLOEXEC);
+  if (efd < 0) {
+    fprintf(stderr, "error: epoll_create, %m\n");
+    return -1;
+  }
+
+  epoll_fd = efd;
+
+  if ((epoll_add(efd, sfd, EVENT_CLIENT, EPOLLIN) != 0) || (epoll_add(efd, lfd, EVENT_CLIENT, EPOLLIN) != 0)) {
+    return -1;
+  }
+
+  for(;;) {
+    int timeout = schedule(&oldset);
+
+    struct epoll_event events[16];
+    int n = epoll_wait(efd, events, 16, timeout);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "error: epoll_wait, %m\n");
+      return -1;
+    }
+
+    for(int i=0; i<n; i++) {
+      int fd = (int)(uint32_t)events[i].data.u64;
+
+      if ((events[i].data.u64 >> 32) == EVENT_NOTIFY) {
+        service_notified(fd);
+      } else if ((events[i].data.u64 >> 32) == EVENT_PROBE) {
+        service_probed(fd);
+      } else if (fd == sfd) {
+        struct signalfd_siginfo fdsi;
+        while (read(sfd, &fdsi, sizeof(fdsi)) == sizeof(fdsi));
+        reap_children();
+      } else if (fd == lfd) {
+        int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd < 0) {
+          fprintf(stderr, "error: accept, %m\n");
+          continue;
+        }
+
+        if (epoll_add(efd, cfd, EVENT_CLIENT, EPOLLIN) != 0) {
+          close(cfd);
+        }
+      } else if (handle_request(fd) <= 0) {
+        forget_waiter(fd);
+        epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+      }
+    }
+  }
+}
+
+
+int
+append(char *buf, size_t size, size_t *len, const char *s) {
+  size_t n = strlen(s) + 1;
+  if (*len + n > size) {
+    fprintf(stderr, "error: arguments too long\n");
+    return -1;
+  }
+
+  memcpy(buf + *len, s, n);
+  *len += n;
+  return 0;
+}
+
+
+int
+request(const char *path, int argc, char *const argv[]) {
+  char buf[65536];
+  size_t len = 0;
+  int count = 0;
+
+  // parse_options has run, --connect is only stripped from options
+  // before optind, never from command of the service
+  char *args[argc];
+  for(int i=1; i<argc; i++) {
+    if ((i < optind) && (strcmp(argv[i], "--connect") == 0)) {
+      i++;
+      continue;
+    } else if ((i < optind) && (strncmp(argv[i], "--connect=", 10) == 0)) {
+      continue;
+    }
+
+    args[count++] = argv[i];
+  }
+
+  char value[16] = {0};
+  snprintf(value, sizeof(value), "%d", count);
+  if (append(buf, sizeof(buf), &len, value) != 0) {
+    return -1;
+  }
+
+  for(int i=0; i<count; i++) {
+    if (append(buf, sizeof(buf), &len, args[i]) != 0) {
+      return -1;
+    }
+  }
+
+  for(char **env = environ; *env; env++) {
+    if (append(buf, sizeof(buf), &len, *env) != 0) {
+      return -1;
+    }
+  }
+
+  struct sockaddr_un addr = {
+    .sun_family = AF_UNIX,
+  };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: socket path too long '%s'\n", path);
+    return -1;
+  }
+
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd __attribute__((cleanup(cleanup_fd))) = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "error: socket, %m\n");
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "error: connect '%s', %m\n", path);
+    return -1;
+  }
+
+  if (send(fd, buf, len, MSG_NOSIGNAL) < 0) {
+    fprintf(stderr, "error: send, %m\n");
+    return -1;
+  }
+
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  int n = poll(&pfd, 1, (opt_timeout > 0)?(int)(opt_timeout * 1000):-1);
+  if (n < 0) {
+    fprintf(stderr, "error: poll, %m\n");
+    return -1;
+  }
+
+  if (n == 0) {
+    fprintf(stderr, "error: not ready in %ld seconds\n", opt_timeout);
+    return -1;
+  }
+
+  ssize_t size = recv(fd, buf, sizeof(buf) - 1, 0);
+  if (size <= 0) {
+    fprintf(stderr, "error: recv reply, %m\n");
+    return -1;
+  }
+  buf[size] = '\0';
+
+  if (strcmp(buf, "-1") == 0) {
+    if (opt_name) {
+      fprintf(stderr, "error: supervisor failed on service '%s', see its log\n", opt_name);
+    } else {
+      fprintf(stderr, "error: supervisor failed, see its log\n");
+    }
+    return -1;
+  }
+
+  if (opt_status) {
+    fputs(buf, stdout);
+  }
+
+  return 0;
+}
+
+
+int
+main(int argc, char *const argv[]) {
+  executable = argv[0];
+
+  if (parse_options(argc, argv) != 0) {
+    goto argument;
+  }
+
+  if (opt_help) {
+    show_usage();
+  }
+
+  if (opt_connect) {
+    if (opt_listen) {
+      fprintf(stderr, "error: --listen and --connect are exclusive\n");
+      goto argument;
+    }
+
+    if ((!opt_status) && (!opt_stop) && ((!opt_name) || (optind >= argc))) {
+      fprintf(stderr, "error: missing name or command\n");
+      goto argument;
+    }
+
+    return (request(opt_connect, argc, argv) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+  }
+
+  if (opt_name || opt_nafter || opt_status || opt_stop) {
+    fprintf(stderr, "error: --name, --after, --status and --stop require --connect\n");
+    goto argument;
+  }
+
+  if (opt_listen && ((optind < argc) || (opt_notify_fd >= 0))) {
+    fprintf(stderr, "error: --listen takes no command\n");
+    goto argument;
+  }
+
+  int waiting = (opt_notify_fd >= 0) || opt_wait_file || opt_wait_port;
+
+  if ((optind >= argc) && (!opt_listen)) {
+    if ((!waiting) || (opt_notify_fd >= 0)) {
+      fprintf(stderr, "error: missing command\n");
+      goto argument;
+    }
+
+    return (wait_ready(-1, -1) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+  }
+
+  // command writes to notify[1] once ready, EOF on notify[0] before
+  // that means it exited
+  int notify[2] = {-1, -1};
+  if ((opt_notify_fd >= 0) && (pipe2(notify, O_CLOEXEC) != 0)) {
+    fprintf(stderr, "error: failed to create notify pipe, %m\n");
+    return EXIT_FAILURE;
+  }
+
+  // the intermediate child writes pid of command to started[1], so
+  // that command exiting before ready is noticed through its pidfd
+  int started[2] = {-1, -1};
+  if (waiting && (pipe2(started, O_CLOEXEC) != 0)) {
+    fprintf(stderr, "error: failed to create pipe, %m\n");
+    return EXIT_FAILURE;
+  }
+
+  {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "error: failed to fork, %m\n");
+      return EXIT_FAILURE;
+    }
+
+    if (pid > 0) {
+      if (!waiting) {
+        _exit(0);
+      }
+
+      if (notify[1] >= 0) {
+        close(notify[1]);
+      }
+      close(started[1]);
+
+      int status;
+      if ((waitpid(pid, &status, 0) < 0) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != 0)) {
+        return EXIT_FAILURE;
+      }
+
+      pid_t command;
+      if (read(started[0], &command, sizeof(command)) != sizeof(command)) {
+        fprintf(stderr, "error: failed to read pid of command\n");
+        return EXIT_FAILURE;
+      }
+
+      // without pidfd_open, exit is only noticed with --notify-fd
+      int pidfd __attribute__((cleanup(cleanup_fd))) = syscall(SYS_pidfd_open, command, 0);
+      if ((pidfd < 0) && (errno == ESRCH)) {
+        fprintf(stderr, "error: exited before ready\n");
+        return EXIT_FAILURE;
+      }
+
+      return (wait_ready(notify[0], pidfd) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+    }
+
+  }
+
+  if (notify[0] >= 0) {
+    close(notify[0]);
+  }
+
+  if (started[0] >= 0) {
+    close(started[0]);
+  }
+
+  if (setsid() < 0) {
+    fprintf(stderr, "error: failed to setsid, %m\n");
+    return EXIT_FAILURE;
+  }
+
+  {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "error: failed to fork again, %m\n");
+      return EXIT_FAILURE;
+    }
+
+    if (pid > 0) {
+      if ((started[1] >= 0) && (write(started[1], &pid, sizeof(pid)) != sizeof(pid))) {
+        _exit(EXIT_FAILURE);
+      }
+      _exit(0);
+    }
+
+  }
+
+  if (started[1] >= 0) {
+    close(started[1]);
+  }
+
+  umask(0);
+
+  if ((redirect(STDIN_FILENO, "/dev/null", O_RDONLY, "stdin") != 0) ||
+      (redirect(STDOUT_FILENO, opt_stdout, O_CREAT|O_WRONLY|O_TRUNC, "stdout") != 0) ||
+      (redirect(STDERR_FILENO, opt_stderr, O_CREAT|O_WRONLY|O_TRUNC, "stderr") != 0)) {
+    return EXIT_FAILURE;
+  }
+
+  if ((notify[1] >= 0) && (pass_notify_fd(notify[1], opt_notify_fd) != 0)) {
+    return EXIT_FAILURE;
+  }
+
+  if (opt_listen) {
+    return (serve(opt_listen) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+  }
+
+  execvp(argv[optind], argv + optind);
+  fprintf(stderr, "error: exec, %m\n");
+  exit(EXIT_FAILURE);
+
 argument:
   fprintf(stderr, "Try '%s --help'\n", executable);
   return EXIT_FAILURE;
@@ -0,0 +1,428 @@
+// node-local registry of spawned processes, an alternative to
+// pidfiles.
+//
+// the registry is a file of fixed layout, usually on tmpfs, mapped
+// shared by every process using it. an entry is keyed by what would
+// otherwise be the pidfile path (or the name), and is written by the
+// process which spawned the child and waits for it, under flock of
+// the registry file. readers do not lock, they copy the entry and
+// retry if its sequence number changed meanwhile.
+//
+// the owner field of an entry is a robust futex of the writer, when
+// the writer dies, the kernel replaces it with FUTEX_OWNER_DIED, and
+// the entry is known to be stale, just like a pidfile whose fcntl
+// lock is released. the kernel walks at most 2048 robust futexes of
+// a thread, entries beyond are left alive when the writer dies.
+//
+// set_robust_list replaces the list glibc registers for robust
+// mutexes, which none of the tools use.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+
+#ifndef SYS_set_robust_list
+#define SYS_set_robust_list 273
+#endif
+
+#define REGISTRY_MAGIC   0x53474552
+#define REGISTRY_VERSION 1
+#define REGISTRY_SLOTS   4096
+#define REGISTRY_KEY_MAX 256
+
+#define REGISTRY_FREE    0
+#define REGISTRY_USED    1
+#define REGISTRY_DELETED 2
+
+// inode numbers of namespaces of the process, in the order of user,
+// uts, ipc, net, cgroup, pid, mnt, 0 if unknown
+#define REGISTRY_NS      7
+
+struct registry_entry {
+  uint32_t seq;
+  uint32_t owner;
+  struct robust_list robust;
+  int32_t pid;
+  uint32_t state;
+  int64_t start_time;
+  uint64_t ns[REGISTRY_NS];
+  char key[REGISTRY_KEY_MAX];
+} __attribute__((aligned(64)));
+
+struct registry_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nslots;
+  uint32_t entry_size;
+} __attribute__((aligned(64)));
+
+struct registry {
+  int fd;
+  size_t size;
+  struct registry_header *header;
+  struct registry_entry *entries;
+};
+
+#define REGISTRY_SIZE (sizeof(struct registry_header) + REGISTRY_SLOTS * sizeof(struct registry_entry))
+
+
+static struct robust_list_head registry_robust_head = {
+  .list = { &registry_robust_head.list },
+  .futex_offset = offsetof(struct registry_entry, owner) - offsetof(struct registry_entry, robust),
+  .list_op_pending = NULL,
+};
+
+static int registry_robust_set = 0;
+
+
+void
+registry_close(struct registry *reg) {
+  if (reg->header != NULL) {
+    munmap(reg->header, reg->size);
+    reg->header = NULL;
+  }
+
+  if (reg->fd >= 0) {
+    close(reg->fd);
+    reg->fd = -1;
+  }
+}
+
+
+// writes the header to an empty registry, fd is opened for writing
+int
+registry_init(int fd, const char *path, size_t size) {
+  if (flock(fd, LOCK_EX) != 0) {
+    fprintf(stderr, "error: lock '%s', %m\n", path);
+    return -1;
+  }
+
+  struct stat buf = {0};
+  if ((fstat(fd, &buf) == 0) && ((size_t)buf.st_size < size)) {
+    struct registry_header header = {
+      .magic = REGISTRY_MAGIC,
+      .version = REGISTRY_VERSION,
+      .nslots = REGISTRY_SLOTS,
+      .entry_size = sizeof(struct registry_entry),
+    };
+
+    if ((ftruncate(fd, size) != 0) || (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))) {
+      fprintf(stderr, "error: initialize '%s', %m\n", path);
+      flock(fd, LOCK_UN);
+      return -1;
+    }
+  }
+
+  flock(fd, LOCK_UN);
+  return 0;
+}
+
+
+// writers create the registry if it does not exist, an empty file is
+// initialized by whoever opens it first, so that creating it with
+// touch is enough to switch a node over to the registry
+int
+registry_open(struct registry *reg, const char *path, int writable) {
+  reg->fd = -1;
+  reg->header = NULL;
+  reg->entries = NULL;
+  reg->size = REGISTRY_SIZE;
+
+  reg->fd = open(path, writable?(O_RDWR|O_CREAT|O_CLOEXEC):(O_RDONLY|O_CLOEXEC), S_IRUSR|S_IWUSR);
+  if (reg->fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", path);
+    return -1;
+  }
+
+  struct stat buf = {0};
+  if (fstat(reg->fd, &buf) != 0) {
+    fprintf(stderr, "error: stat '%s', %m\n", path);
+    registry_close(reg);
+    return -1;
+  }
+
+  if ((size_t)buf.st_size < reg->size) {
+    int fd = writable?reg->fd:open(path, O_RDWR|O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "error: open '%s', %m\n", path);
+      registry_close(reg);
+      return -1;
+    }
+
+    int result = registry_init(fd, path, reg->size);
+    if (fd != reg->fd) {
+      close(fd);
+    }
+
+    if (result != 0) {
+      registry_close(reg);
+      return -1;
+    }
+  }
+
+  void *addr = mmap(NULL, reg->size, writable?(PROT_READ|PROT_WRITE):PROT_READ, MAP_SHARED, reg->fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "error: mmap '%s', %m\n", path);
+    registry_close(reg);
+    return -1;
+  }
+
+  reg->header = addr;
+  reg->entries = (struct registry_entry *)(reg->header + 1);
+
+  if ((reg->header->magic != REGISTRY_MAGIC) ||
+      (reg->header->version != REGISTRY_VERSION) ||
+      (reg->header->nslots != REGISTRY_SLOTS) ||
+      (reg->header->entry_size != sizeof(struct registry_entry))) {
+    fprintf(stderr, "error: registry '%s' has unknown layout\n", path);
+    registry_close(reg);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+uint32_t
+registry_hash(const char *key) {
+  uint32_t h = 2166136261u;
+  for(; *key; key++) {
+    h = (h ^ (unsigned char)*key) * 16777619u;
+  }
+  return h;
+}
+
+
+// copies a consistent snapshot of the entry. a writer dead in the
+// middle of an update leaves the sequence number odd, which is only
+// known for sure when the entry stays odd under the lock of writers,
+// returns -1 in that case.
+int
+registry_read(struct registry *reg, size_t slot, struct registry_entry *entry) {
+  struct registry_entry *e = &reg->entries[slot];
+
+  for(int i=0; i<100; i++) {
+    uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      continue;
+    }
+
+    memcpy(entry, e, sizeof(struct registry_entry));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq) {
+      entry->key[REGISTRY_KEY_MAX-1] = '\0';
+      return 0;
+    }
+  }
+
+  flock(reg->fd, LOCK_SH);
+  memcpy(entry, e, sizeof(struct registry_entry));
+  flock(reg->fd, LOCK_UN);
+
+  entry->key[REGISTRY_KEY_MAX-1] = '\0';
+  return (entry->seq & 1)?-1:0;
+}
+
+
+int
+registry_alive(const struct registry_entry *entry) {
+  return (entry->state == REGISTRY_USED) && (entry->owner & FUTEX_TID_MASK) && !(entry->owner & FUTEX_OWNER_DIED);
+}
+
+
+// true if the entry has not changed since the snapshot, after the
+// pid of the snapshot is resolved to a pidfd, this means the pidfd
+// refers to the registered process, not a recycled pid
+int
+registry_unchanged(struct registry *reg, size_t slot, const struct registry_entry *entry) {
+  return __atomic_load_n(&reg->entries[slot].seq, __ATOMIC_ACQUIRE) == entry->seq;
+}
+
+
+// returns the slot of the key, or -1 with errno ENOENT
+ssize_t
+registry_lookup(struct registry *reg, const char *key, struct registry_entry *entry) {
+  size_t start = registry_hash(key) % REGISTRY_SLOTS;
+
+  for(size_t i=0; i<REGISTRY_SLOTS; i++) {
+    size_t slot = (start + i) % REGISTRY_SLOTS;
+
+    if (registry_read(reg, slot, entry) != 0) {
+      continue;
+    }
+
+    if (entry->state == REGISTRY_FREE) {
+      break;
+    }
+
+    if ((entry->state == REGISTRY_USED) && (strcmp(entry->key, key) == 0)) {
+      return slot;
+    }
+  }
+
+  errno = ENOENT;
+  return -1;
+}
+
+
+void
+registry_begin(struct registry_entry *e) {
+  __atomic_store_n(&e->seq, e->seq | 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+void
+registry_end(struct registry_entry *e) {
+  __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+// registers pid under key, owned by the calling thread until
+// registry_remove. an entry of the same key left by a dead owner is
+// replaced. returns the slot, or -1.
+ssize_t
+registry_add(struct registry *reg, const char *key, pid_t pid, int64_t start_time, const uint64_t ns[REGISTRY_NS]) {
+  if (strlen(key) >= REGISTRY_KEY_MAX) {
+    fprintf(stderr, "error: registry key too long '%s'\n", key);
+    return -1;
+  }
+
+  if (!registry_robust_set) {
+    if (syscall(SYS_set_robust_list, &registry_robust_head, sizeof(registry_robust_head)) != 0) {
+      fprintf(stderr, "error: set_robust_list, %m\n");
+      return -1;
+    }
+    registry_robust_set = 1;
+  }
+
+  if (flock(reg->fd, LOCK_EX) != 0) {
+    fprintf(stderr, "error: lock registry, %m\n");
+    return -1;
+  }
+
+  size_t start = registry_hash(key) % REGISTRY_SLOTS;
+  ssize_t slot = -1;
+
+  for(size_t i=0; i<REGISTRY_SLOTS; i++) {
+    size_t s = (start + i) % REGISTRY_SLOTS;
+    struct registry_entry *e = &reg->entries[s];
+
+    if (e->state == REGISTRY_FREE) {
+      slot = (slot < 0)?(ssize_t)s:slot;
+      break;
+    }
+
+    int alive = registry_alive(e) && !(e->seq & 1);
+
+    if ((e->state == REGISTRY_USED) && (strncmp(e->key, key, REGISTRY_KEY_MAX) == 0)) {
+      if (alive) {
+        fprintf(stderr, "error: '%s' already registered\n", key);
+        flock(reg->fd, LOCK_UN);
+        return -1;
+      }
+
+      slot = (slot < 0)?(ssize_t)s:slot;
+      continue;
+    }
+
+    if ((slot < 0) && !alive) {
+      slot = s;
+    }
+  }
+
+  if (slot < 0) {
+    fprintf(stderr, "error: registry full\n");
+    flock(reg->fd, LOCK_UN);
+    return -1;
+  }
+
+  struct registry_entry *e = &reg->entries[slot];
+  pid_t tid = syscall(SYS_gettid);
+
+  registry_begin(e);
+
+  // an entry of the same key further along the probe sequence is
+  // stale, mark it deleted so lookups do not find it
+  for(size_t i=1; i<REGISTRY_SLOTS; i++) {
+    struct registry_entry *other = &reg->entries[(slot + i) % REGISTRY_SLOTS];
+    if (other->state == REGISTRY_FREE) {
+      break;
+    }
+
+    if ((other->state == REGISTRY_USED) && (strncmp(other->key, key, REGISTRY_KEY_MAX) == 0)) {
+      registry_begin(other);
+      other->state = REGISTRY_DELETED;
+      registry_end(other);
+    }
+  }
+
+  registry_robust_head.list_op_pending = &e->robust;
+  e->robust.next = registry_robust_head.list.next;
+  e->pid = pid;
+  e->state = REGISTRY_USED;
+  e->start_time = start_time;
+  memcpy(e->ns, ns, sizeof(e->ns));
+  strncpy(e->key, key, REGISTRY_KEY_MAX);
+  __atomic_store_n(&e->owner, tid, __ATOMIC_RELAXED);
+  registry_robust_head.list.next = &e->robust;
+  registry_robust_head.list_op_pending = NULL;
+
+  registry_end(e);
+
+  flock(reg->fd, LOCK_UN);
+  return slot;
+}
+
+
+// a deleted entry followed by a free one ends no probe sequence but
+// its own, so it and deleted entries right before it are freed again.
+// otherwise, with a unique key for each process, the registry fills up
+// with deleted entries, and lookups of missing keys scan all of them.
+// called under the lock of writers.
+void
+registry_reclaim(struct registry *reg, size_t slot) {
+  if (reg->entries[(slot + 1) % REGISTRY_SLOTS].state != REGISTRY_FREE) {
+    return;
+  }
+
+  for(size_t i=0; i<REGISTRY_SLOTS; i++) {
+    struct registry_entry *e = &reg->entries[(slot + REGISTRY_SLOTS - i) % REGISTRY_SLOTS];
+    if (e->state != REGISTRY_DELETED) {
+      break;
+    }
+
+    registry_begin(e);
+    e->state = REGISTRY_FREE;
+    registry_end(e);
+  }
+}
+
+
+void
+registry_remove(struct registry *reg, size_t slot) {
+  struct registry_entry *e = &reg->entries[slot];
+
+  flock(reg->fd, LOCK_EX);
+  registry_begin(e);
+
+  registry_robust_head.list_op_pending = &e->robust;
+  for(struct robust_list *p = &registry_robust_head.list; p->next != &registry_robust_head.list; p = p->next) {
+    if (p->next == &e->robust) {
+      p->next = e->robust.next;
+      break;
+    }
+  }
+
+  e->state = REGISTRY_DELETED;
+  e->pid = 0;
+  __atomic_store_n(&e->owner, 0, __ATOMIC_RELAXED);
+  registry_robust_head.list_op_pending = NULL;
+
+  registry_end(e);
+  registry_reclaim(reg, slot);
+  flock(reg->fd, LOCK_UN);
+}
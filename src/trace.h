@@ -0,0 +1,112 @@
+// startup traces of unspawn and unenter.
+//
+// with --trace=FILE, the tool appends a record to FILE as each phase
+// of starting the process completes, both in itself and in the child
+// until it execs. FILE is opened O_APPEND, and each record is written
+// with a single write, so that processes may trace to the same file.
+// FILE may be /dev/fd/N, to trace to an inherited fd instead.
+//
+// a record is TRACE_RECORD_SIZE bytes, in host byte order:
+//
+//   uint32_t magic     TRACE_MAGIC
+//   uint16_t version   TRACE_VERSION
+//   uint16_t phase     one of TRACE_* below
+//   int32_t  pid       pid of the child, once cloned, or of the process
+//                      unenter entered, 0 otherwise
+//   uint32_t reserved  0
+//   int64_t  time      CLOCK_MONOTONIC, in nanoseconds
+//   char     key[]     what would be the key in the registry, i.e.
+//                      PIDFILE, or NAME without --pidfile, truncated
+//                      to TRACE_KEY_MAX - 1 bytes, NUL padded
+//
+// time of a record is when its phase ended, so that the duration of
+// a phase is the time since the record before it of the same key.
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_MAGIC       0x43525455
+#define TRACE_VERSION     1
+#define TRACE_KEY_MAX     232
+
+#define TRACE_START       1  // options parsed
+#define TRACE_NETNS       2  // netns opened, or joined by unspawn
+#define TRACE_USERNS      3  // user namespace created, maps written
+#define TRACE_CGROUP      4  // cgroup created, limits written
+#define TRACE_CLONE       5  // child cloned, in the parent
+#define TRACE_CHILD       6  // child running, joined its cgroup
+#define TRACE_SETNS       7  // child joined netns
+#define TRACE_HOSTNAME    8  // child set hostname and domain name
+#define TRACE_PLACEMENT   9  // child set CPU affinity and mempolicy
+#define TRACE_EXEC_HELPER 10 // child started exec helper
+#define TRACE_REGISTER    11 // pidfile linked, or registry entry added
+#define TRACE_CONTINUE    12 // SIGCONT sent to child
+#define TRACE_EXEC        13 // child about to exec the command
+#define TRACE_LOOKUP      14 // unenter found the process to enter
+#define TRACE_CONTEXT     15 // unenter loaded working directory and environment
+#define TRACE_ENTER       16 // unenter joined namespaces, and root
+
+struct trace_record {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t phase;
+  int32_t pid;
+  uint32_t reserved;
+  int64_t time;
+  char key[TRACE_KEY_MAX];
+};
+
+#define TRACE_RECORD_SIZE sizeof(struct trace_record)
+
+static int trace_fd = -1;
+static char trace_key[TRACE_KEY_MAX];
+
+
+// opens FILE to trace the process under key, returns -1 on error
+int
+trace_open(const char *path, const char *key) {
+  trace_fd = open(path, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR);
+  if (trace_fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", path);
+    return -1;
+  }
+
+  memset(trace_key, 0, sizeof(trace_key));
+  strncpy(trace_key, key, sizeof(trace_key) - 1);
+  return 0;
+}
+
+
+void
+trace_close() {
+  if (trace_fd < 0)
+    return;
+  close(trace_fd);
+  trace_fd = -1;
+}
+
+
+// records end of phase, a failed write is ignored, as tracing must
+// not fail the process being started
+void
+trace(uint16_t phase, pid_t pid) {
+  if (trace_fd < 0)
+    return;
+
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  struct trace_record record = {
+    .magic = TRACE_MAGIC,
+    .version = TRACE_VERSION,
+    .phase = phase,
+    .pid = pid,
+    .time = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec,
+  };
+  memcpy(record.key, trace_key, sizeof(record.key));
+
+  if (write(trace_fd, &record, sizeof(record)) < 0) {
+    return;
+  }
+}
@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+#include <getopt.h>
+
+#include "trace.h"
+
+#define OPT_BINDIR   0
+#define OPT_TSV      1
+
+// samples of a run, total and one per phase traced
+#define PHASE_TOTAL  0
+#define PHASE_MAX    (TRACE_ENTER + 1)
+
+#define TOOL_UNSPAWN 0
+#define TOOL_UNENTER 1
+#define TOOL_UNCHECK 2
+#define TOOL_MAX     3
+
+static const char *tool_names[TOOL_MAX] = {"unspawn", "unenter", "uncheck"};
+
+static const char *phase_names[PHASE_MAX] = {
+  [PHASE_TOTAL] = "total",
+  [TRACE_START] = "start",
+  [TRACE_NETNS] = "netns",
+  [TRACE_USERNS] = "userns",
+  [TRACE_CGROUP] = "cgroup",
+  [TRACE_CLONE] = "clone",
+  [TRACE_CHILD] = "child",
+  [TRACE_SETNS] = "setns",
+  [TRACE_HOSTNAME] = "hostname",
+  [TRACE_PLACEMENT] = "placement",
+  [TRACE_EXEC_HELPER] = "exec-helper",
+  [TRACE_REGISTER] = "register",
+  [TRACE_CONTINUE] = "continue",
+  [TRACE_EXEC] = "exec",
+  [TRACE_LOOKUP] = "lookup",
+  [TRACE_CONTEXT] = "context",
+  [TRACE_ENTER] = "enter",
+};
+
+static char *executable = NULL;
+static long opt_iterations = 100;
+static long opt_jobs = 1;
+static char *opt_bindir = NULL;
+static int opt_tsv = 0;
+
+static char rundir[] = "/tmp/unbench.XXXXXX";
+
+static struct option options[] = {
+  {"iterations",   required_argument, NULL, 'n'},
+  {"jobs",         required_argument, NULL, 'j'},
+  {"bindir",       required_argument, NULL, OPT_BINDIR},
+  {"tsv",          no_argument,       NULL, OPT_TSV},
+
+  {"help",         no_argument,       NULL, 'h'},
+  {NULL,           no_argument,       NULL, 0}
+};
+
+
+void
+show_usage() {
+  printf("Usage: %s [options] [--] [unspawn|unenter|uncheck]...\n", executable);
+  printf("\n"
+         "Run each tool, all of them by default, in new user namespaces, and\n"
+         "report throughput, and p50, p99 and max latency of each run and of\n"
+         "each phase traced by the tool.\n"
+         "\n"
+         "  -n, --iterations=N         run each tool N times, default 100\n"
+         "  -j, --jobs=N               run N at once, default 1\n"
+         "      --bindir=DIR           directory of tools, default that of %s\n"
+         "      --tsv                  print one line 'TOOL<TAB>PHASE<TAB>RUNS<TAB>\n"
+         "                             FAILED<TAB>PER_SECOND<TAB>P50<TAB>P99<TAB>MAX'\n"
+         "                             for each, latencies in nanoseconds\n"
+         "\n"
+         "  -h, --help                 print help message and exit\n",
+         executable
+         );
+  exit(EXIT_SUCCESS);
+}
+
+
+void
+cleanup_fd(int *fd) {
+  if (*fd < 0)
+    return;
+  close(*fd);
+}
+
+
+int64_t
+now() {
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+// runs argv with stdout to /dev/null, returns -1 if it failed
+int
+run(char *const argv[]) {
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    fprintf(stderr, "error: fork, %m\n");
+    return -1;
+  }
+
+  if (pid == 0) {
+    int fd = open("/dev/null", O_WRONLY|O_CLOEXEC);
+    if ((fd < 0) || (dup2(fd, STDOUT_FILENO) < 0)) {
+      fprintf(stderr, "error: redirect stdout, %m\n");
+      exit(EXIT_FAILURE);
+    }
+    execv(argv[0], argv);
+    fprintf(stderr, "error: exec '%s', %m\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0) {
+    fprintf(stderr, "error: waitpid, %m\n");
+    return -1;
+  }
+
+  return (WIFEXITED(status) && (WEXITSTATUS(status) == 0))?0:-1;
+}
+
+
+// starts process for unenter and uncheck of worker to run against,
+// returns once its pidfile is written
+pid_t
+start_target(long worker) {
+  char path[PATH_MAX] = {0};
+  char name[64] = {0};
+  snprintf(path, PATH_MAX, "%s/unspawn", opt_bindir);
+  snprintf(name, sizeof(name), "target-%ld", worker);
+
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    fprintf(stderr, "error: fork, %m\n");
+    return -1;
+  }
+
+  if (pid == 0) {
+    char *argv[] = {path, "--user", "-n", name, "--", "sleep", "1000000", NULL};
+    execv(argv[0], argv);
+    fprintf(stderr, "error: exec '%s', %m\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  char pidfile[PATH_MAX] = {0};
+  snprintf(pidfile, PATH_MAX, "%s/userns/%s", rundir, name);
+
+  struct stat st;
+  for(int i=0; i<5000; i++) {
+    if (stat(pidfile, &st) == 0) {
+      return pid;
+    }
+    if (waitpid(pid, NULL, WNOHANG) == pid) {
+      break;
+    }
+    usleep(1000);
+  }
+
+  fprintf(stderr, "error: target '%s' not started\n", name);
+  kill(pid, SIGKILL);
+  return -1;
+}
+
+
+void
+stop_target(long worker, pid_t pid) {
+  char path[PATH_MAX] = {0};
+  char name[64] = {0};
+  snprintf(path, PATH_MAX, "%s/uncheck", opt_bindir);
+  snprintf(name, sizeof(name), "target-%ld", worker);
+
+  char *argv[] = {path, "-k", "-n", name, NULL};
+  if (run(argv) != 0) {
+    kill(pid, SIGKILL);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+
+// reads records appended to trace since last run, and stores duration
+// of each phase in samples, since the one before it, and since start
+// for the first one
+void
+read_trace(int fd, int64_t start, int64_t *samples) {
+  struct trace_record records[PHASE_MAX * 2];
+  size_t n = 0;
+
+  while (n < sizeof(records)/sizeof(records[0])) {
+    ssize_t size = read(fd, &records[n], TRACE_RECORD_SIZE);
+    if (size != (ssize_t)TRACE_RECORD_SIZE) {
+      break;
+    }
+    if ((records[n].magic == TRACE_MAGIC) && (records[n].version == TRACE_VERSION) && (records[n].phase < PHASE_MAX)) {
+      n++;
+    }
+  }
+
+  // child and parent race, sort records by time
+  for(size_t i=1; i<n; i++) {
+    for(size_t j=i; (j>0) && (records[j-1].time > records[j].time); j--) {
+      struct trace_record record = records[j];
+      records[j] = records[j-1];
+      records[j-1] = record;
+    }
+  }
+
+  int64_t last = start;
+  for(size_t i=0; i<n; i++) {
+    samples[records[i].phase] = records[i].time - last;
+    last = records[i].time;
+  }
+}
+
+
+// runs tool for iterations of worker, and stores samples of each, all
+// -1 for a failed run
+void
+bench_worker(int tool, long worker, int64_t *samples) {
+  char path[PATH_MAX] = {0};
+  char trace[PATH_MAX] = {0};
+  char trace_opt[PATH_MAX + 8] = {0};
+  char target[64] = {0};
+  snprintf(path, PATH_MAX, "%s/%s", opt_bindir, tool_names[tool]);
+  snprintf(trace, PATH_MAX, "%s/trace-%ld", rundir, worker);
+  snprintf(trace_opt, sizeof(trace_opt), "--trace=%s", trace);
+  snprintf(target, sizeof(target), "target-%ld", worker);
+
+  int fd __attribute__((cleanup(cleanup_fd))) = open(trace, O_RDONLY|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+  if (fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", trace);
+    exit(EXIT_FAILURE);
+  }
+
+  long first = worker * opt_iterations / opt_jobs;
+  long last = (worker + 1) * opt_iterations / opt_jobs;
+
+  for(long i=first; i<last; i++) {
+    int64_t *sample = samples + i * PHASE_MAX;
+    char name[64] = {0};
+    snprintf(name, sizeof(name), "bench-%ld", i);
+
+    char *unspawn_argv[] = {path, "--user", "-n", name, trace_opt, "--", "true", NULL};
+    char *unenter_argv[] = {path, "-n", target, trace_opt, "--", "true", NULL};
+    char *uncheck_argv[] = {path, "-n", target, NULL};
+    char *const *argv[TOOL_MAX] = {unspawn_argv, unenter_argv, uncheck_argv};
+
+    int64_t start = now();
+    int result = run(argv[tool]);
+    int64_t total = now() - start;
+
+    // records of a failed run are read, and dropped
+    int64_t phases[PHASE_MAX];
+    read_trace(fd, start, (result == 0)?sample:phases);
+
+    if (result == 0) {
+      sample[PHASE_TOTAL] = total;
+    }
+  }
+}
+
+
+int
+compare_int64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+void
+report(int tool, const int64_t *samples, int64_t elapsed) {
+  int64_t *values = calloc(opt_iterations, sizeof(int64_t));
+  if (!values) {
+    fprintf(stderr, "error: allocate, %m\n");
+    exit(EXIT_FAILURE);
+  }
+
+  long failed = 0;
+  for(long i=0; i<opt_iterations; i++) {
+    if (samples[i * PHASE_MAX + PHASE_TOTAL] < 0) {
+      failed++;
+    }
+  }
+
+  double per_second = (opt_iterations - failed) * 1e9 / elapsed;
+
+  if (!opt_tsv) {
+    printf("%s: %ld runs, %ld failed, %.1f/s\n", tool_names[tool], opt_iterations, failed, per_second);
+    printf("  %-12s %8s %10s %10s %10s\n", "phase", "runs", "p50(us)", "p99(us)", "max(us)");
+  }
+
+  for(int phase=0; phase<PHASE_MAX; phase++) {
+    long n = 0;
+    for(long i=0; i<opt_iterations; i++) {
+      int64_t value = samples[i * PHASE_MAX + phase];
+      if (value >= 0) {
+        values[n++] = value;
+      }
+    }
+
+    if (n == 0) {
+      continue;
+    }
+
+    qsort(values, n, sizeof(int64_t), compare_int64);
+    int64_t p50 = values[(n - 1) * 50 / 100];
+    int64_t p99 = values[(n - 1) * 99 / 100];
+    int64_t max = values[n - 1];
+
+    if (opt_tsv) {
+      printf("%s\t%s\t%ld\t%ld\t%.1f\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\n",
+             tool_names[tool], phase_names[phase], n, failed, per_second, p50, p99, max);
+    } else {
+      printf("  %-12s %8ld %10.1f %10.1f %10.1f\n", phase_names[phase], n, p50 / 1e3, p99 / 1e3, max / 1e3);
+    }
+  }
+
+  free(values);
+  // not to be flushed again by workers of the next tool
+  fflush(stdout);
+}
+
+
+// runs tool with jobs workers at once, returns -1 on error
+int
+bench(int tool) {
+  size_t size = opt_iterations * PHASE_MAX * sizeof(int64_t);
+  int64_t *samples = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (samples == MAP_FAILED) {
+    fprintf(stderr, "error: mmap, %m\n");
+    return -1;
+  }
+  memset(samples, 0xff, size);
+
+  pid_t targets[opt_jobs];
+  for(long i=0; i<opt_jobs; i++) {
+    targets[i] = -1;
+  }
+
+  int result = 0;
+  if (tool != TOOL_UNSPAWN) {
+    for(long i=0; i<opt_jobs; i++) {
+      targets[i] = start_target(i);
+      if (targets[i] < 0) {
+        result = -1;
+        break;
+      }
+    }
+  }
+
+  pid_t workers[opt_jobs];
+  int64_t start = now();
+
+  for(long i=0; i<opt_jobs; i++) {
+    workers[i] = (result == 0)?fork():-1;
+    if ((result == 0) && (workers[i] < 0)) {
+      fprintf(stderr, "error: fork, %m\n");
+      result = -1;
+    }
+    if (workers[i] == 0) {
+      bench_worker(tool, i, samples);
+      exit(EXIT_SUCCESS);
+    }
+  }
+
+  for(long i=0; i<opt_jobs; i++) {
+    if ((workers[i] > 0) && (waitpid(workers[i], NULL, 0) < 0)) {
+      fprintf(stderr, "error: waitpid, %m\n");
+      result = -1;
+    }
+  }
+
+  int64_t elapsed = now() - start;
+
+  if (result == 0) {
+    report(tool, samples, elapsed);
+  }
+
+  for(long i=0; i<opt_jobs; i++) {
+    if (targets[i] >= 0) {
+      stop_target(i, targets[i]);
+    }
+  }
+
+  munmap(samples, size);
+  return result;
+}
+
+
+void
+cleanup_rundir() {
+  char path[PATH_MAX] = {0};
+
+  for(long i=0; i<opt_jobs; i++) {
+    snprintf(path, PATH_MAX, "%s/trace-%ld", rundir, i);
+    unlink(path);
+  }
+
+  snprintf(path, PATH_MAX, "%s/userns", rundir);
+  rmdir(path);
+  rmdir(rundir);
+}
+
+
+int
+main(int argc, char *const argv[]) {
+  executable = argv[0];
+
+  int opt, index;
+  char *end;
+
+  while((opt = getopt_long(argc, argv, "+n:j:h", options, &index)) != -1) {
+    switch(opt) {
+    case '?':
+      goto argument;
+
+    case 'h':
+      show_usage();
+      break;
+
+    case 'n':
+      opt_iterations = strtol(optarg, &end, 10);
+      if ((*end != '\0') || (opt_iterations <= 0)) {
+        fprintf(stderr, "error: invalid iterations '%s'\n", optarg);
+        goto argument;
+      }
+      break;
+
+    case 'j':
+      opt_jobs = strtol(optarg, &end, 10);
+      if ((*end != '\0') || (opt_jobs <= 0)) {
+        fprintf(stderr, "error: invalid jobs '%s'\n", optarg);
+        goto argument;
+      }
+      break;
+
+    case OPT_BINDIR:
+      opt_bindir = optarg;
+      break;
+
+    case OPT_TSV:
+      opt_tsv = 1;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  if (opt_jobs > opt_iterations) {
+    opt_jobs = opt_iterations;
+  }
+
+  char bindir[PATH_MAX] = {0};
+  if (!opt_bindir) {
+    strncpy(bindir, argv[0], PATH_MAX - 1);
+    opt_bindir = dirname(bindir);
+  }
+
+  int tools[TOOL_MAX];
+  int ntools = 0;
+
+  if (optind >= argc) {
+    for(int tool=0; tool<TOOL_MAX; tool++) {
+      tools[ntools++] = tool;
+    }
+  }
+
+  for(int i=optind; i<argc; i++) {
+    int tool = 0;
+    while ((tool < TOOL_MAX) && (strcmp(argv[i], tool_names[tool]) != 0)) {
+      tool++;
+    }
+
+    if (tool == TOOL_MAX) {
+      fprintf(stderr, "error: unknown tool '%s'\n", argv[i]);
+      goto argument;
+    }
+
+    if (ntools == TOOL_MAX) {
+      fprintf(stderr, "error: too many tools\n");
+      goto argument;
+    }
+
+    tools[ntools++] = tool;
+  }
+
+  if (!mkdtemp(rundir)) {
+    fprintf(stderr, "error: mkdtemp, %m\n");
+    return EXIT_FAILURE;
+  }
+
+  char path[PATH_MAX] = {0};
+  snprintf(path, PATH_MAX, "%s/userns", rundir);
+  if (mkdir(path, 0700) != 0) {
+    fprintf(stderr, "error: mkdir '%s', %m\n", path);
+    rmdir(rundir);
+    return EXIT_FAILURE;
+  }
+
+  if (setenv("XDG_RUNTIME_DIR", rundir, 1) != 0) {
+    fprintf(stderr, "error: setenv, %m\n");
+    cleanup_rundir();
+    return EXIT_FAILURE;
+  }
+
+  int result = EXIT_SUCCESS;
+  for(int i=0; i<ntools; i++) {
+    if (bench(tools[i]) != 0) {
+      result = EXIT_FAILURE;
+      break;
+    }
+  }
+
+  cleanup_rundir();
+  return result;
+argument:
+  fprintf(stderr, "Try '%s --help'\n", executable);
+  return EXIT_FAILURE;
+}
@@ -1,24 +1,45 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <linux/limits.h>
 #include <getopt.h>
 
+#include "registry.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
 #define OPT_PIDFILE  0
+#define OPT_BATCH    1
+#define OPT_REGISTRY 2
 
 static char *executable = NULL;
 static char* opt_name = NULL;
 static char *opt_pidfile = NULL;
 static int opt_kill = 0;
+static char *opt_batch = NULL;
+static char *opt_registry = NULL;
 
 
 static struct option options[] = {
   {"name",         required_argument, NULL, 'n'},
   {"pidfile",      required_argument, NULL, OPT_PIDFILE},
-  {"kill",         required_argument, NULL, 'k'},
+  {"kill",         no_argument,       NULL, 'k'},
+  {"batch",        required_argument, NULL, OPT_BATCH},
+  {"registry",     required_argument, NULL, OPT_REGISTRY},
 
   {"help",         no_argument,       NULL, 'h'},
   {NULL,           no_argument,       NULL, 0}
@@ -32,6 +53,10 @@ show_usage() {
          "  -n, --name=NAME            name of the namespace\n"
          "      --pidfile=PIDFILE      path to pidfile\n"
          "  -k, --kill                 kill process\n"
+         "      --batch=DIR            check all pidfiles under DIR, print one\n"
+         "                             line 'PATH<TAB>running|exited' for each\n"
+         "      --registry=FILE        look up PIDFILE, or NAME without --pidfile, in\n"
+         "                             FILE instead, with --batch, entries under DIR\n"
          "\n"
          "  -h, --help                 print help message and exit\n"
          );
@@ -47,10 +72,259 @@ cleanup_fd(int *fd) {
 }
 
 
+// returns -1 with errno ENOSYS on kernels without pidfd
+int
+_pidfd_open(pid_t pid) {
+  return syscall(SYS_pidfd_open, pid, 0);
+}
+
+
+int
+_pidfd_send_signal(int pidfd, int sig) {
+  return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+}
+
+
+// in batch mode, a pidfile failing the check is reported as exited
+// rather than as an error
+#define check_error(...) do { if (!opt_batch) fprintf(stderr, __VA_ARGS__); } while(0)
+
+
+// pidfd of the process is known to refer to pid here
+int
+check_pid(pid_t pid, int pidfd) {
+  if (pidfd >= 0) {
+    struct pollfd pfd = {
+      .fd = pidfd,
+      .events = POLLIN,
+    };
+
+    int n = poll(&pfd, 1, 0);
+    if (n < 0) {
+      check_error("error: poll pidfd, %m\n");
+      return -1;
+    }
+
+    if (n > 0) {
+      check_error("error: process exited\n");
+      return -1;
+    }
+  }
+
+  if (opt_kill) {
+    if (pidfd >= 0) {
+      _pidfd_send_signal(pidfd, SIGKILL);
+    } else {
+      kill(pid, SIGKILL);
+    }
+  }
+
+  return 0;
+}
+
+
+int
+check(int fd) {
+  struct stat buf = {0};
+  if (fstat(fd, &buf) != 0) {
+    check_error("error: stat, %m\n");
+    return -1;
+  }
+
+  off_t len = buf.st_size;
+
+  char s[len+1];
+  if (read(fd, s, len) != len) {
+    check_error("error: read pidfile, %m\n");
+    return -1;
+  }
+
+  s[len] = '\0';
+  pid_t pid;
+  if (sscanf(s, "%d", &pid) == EOF) {
+    check_error("error: sscanf pid, %m\n");
+    return -1;
+  }
+
+  // the child is reaped only after the pidfile is unlocked, so if
+  // the pidfile is still locked below, pidfd refers to the child
+  int pidfd __attribute__((cleanup(cleanup_fd))) = _pidfd_open(pid);
+  if ((pidfd < 0) && (errno != ENOSYS)) {
+    check_error("error: pidfd_open, %m\n");
+    return -1;
+  }
+
+  struct flock lock = {
+    .l_type = F_WRLCK,
+    .l_whence = SEEK_SET,
+    .l_start = 0,
+    .l_len = len,
+  };
+
+  if (fcntl(fd, F_GETLK, &lock) != 0) {
+    check_error("error: test lock pidfile, %m\n");
+    return -1;
+  }
+
+  if (lock.l_type == F_UNLCK) {
+    check_error("error: pidfile not locked\n");
+    return -1;
+  }
+
+  return check_pid(pid, pidfd);
+}
+
+
+// the child is removed from the registry before it is reaped, so if
+// the entry is unchanged after pidfd_open, pidfd refers to the child
+int
+check_entry(struct registry *reg, size_t slot, const struct registry_entry *entry) {
+  if (!registry_alive(entry)) {
+    check_error("error: owner of '%s' died\n", entry->key);
+    return -1;
+  }
+
+  int pidfd __attribute__((cleanup(cleanup_fd))) = _pidfd_open(entry->pid);
+  if ((pidfd < 0) && (errno != ENOSYS) && (errno != ESRCH)) {
+    check_error("error: pidfd_open, %m\n");
+    return -1;
+  }
+
+  if (((pidfd < 0) && (errno == ESRCH)) || !registry_unchanged(reg, slot, entry)) {
+    check_error("error: process exited\n");
+    return -1;
+  }
+
+  return check_pid(entry->pid, pidfd);
+}
+
+
+int
+check_registered(struct registry *reg, const char *key) {
+  struct registry_entry entry;
+  ssize_t slot = registry_lookup(reg, key, &entry);
+  if (slot < 0) {
+    check_error("error: '%s' not registered\n", key);
+    return -1;
+  }
+
+  return check_entry(reg, slot, &entry);
+}
+
+
+// same output as check_batch, for entries with key DIR/PATH.pid
+int
+check_registry(struct registry *reg, const char *dir) {
+  size_t len = strlen(dir);
+  while ((len > 1) && (dir[len-1] == '/')) {
+    len--;
+  }
+
+  for(size_t slot=0; slot<REGISTRY_SLOTS; slot++) {
+    struct registry_entry entry;
+    if ((registry_read(reg, slot, &entry) != 0) || (entry.state != REGISTRY_USED)) {
+      continue;
+    }
+
+    const char *key = entry.key;
+    size_t n = strlen(key);
+
+    if ((n <= len + 5) || (strncmp(key, dir, len) != 0) || (key[len] != '/') || (strcmp(key + n - 4, ".pid") != 0)) {
+      continue;
+    }
+
+    printf("%.*s\t%s\n", (int)(n - len - 5), key + len + 1, (check_entry(reg, slot, &entry) == 0)?"running":"exited");
+  }
+
+  return 0;
+}
+
+
+void
+cleanup_dir(DIR **dir) {
+  if (*dir == NULL)
+    return;
+  closedir(*dir);
+}
+
+
+// path is the directory relative to --batch=DIR, with trailing slash
+int
+check_batch(int dirfd, char *path, size_t len) {
+  DIR *dir __attribute__((cleanup(cleanup_dir))) = fdopendir(dirfd);
+  if (dir == NULL) {
+    fprintf(stderr, "error: opendir '%s', %m\n", path);
+    close(dirfd);
+    return -1;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    const char *name = entry->d_name;
+    size_t n = strlen(name);
+
+    if (name[0] == '.') {
+      continue;
+    }
+
+    unsigned char type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+      struct stat buf = {0};
+      if (fstatat(dirfd, name, &buf, AT_SYMLINK_NOFOLLOW) != 0) {
+        continue;
+      }
+      type = S_ISDIR(buf.st_mode)?DT_DIR:(S_ISREG(buf.st_mode)?DT_REG:DT_UNKNOWN);
+    }
+
+    if (type == DT_DIR) {
+      if (len + n + 2 > PATH_MAX) {
+        continue;
+      }
+
+      // removed while we are walking
+      int fd = openat(dirfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+      if (fd < 0) {
+        continue;
+      }
+
+      memcpy(path + len, name, n);
+      path[len + n] = '/';
+      path[len + n + 1] = '\0';
+
+      int result = check_batch(fd, path, len + n + 1);
+      path[len] = '\0';
+
+      if (result != 0) {
+        return -1;
+      }
+
+      continue;
+    }
+
+    if ((type != DT_REG) || (n <= 4) || (strcmp(name + n - 4, ".pid") != 0)) {
+      continue;
+    }
+
+    // process exited and pidfile unlinked while we are walking
+    int fd __attribute__((cleanup(cleanup_fd))) = openat(dirfd, name, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+
+    printf("%s%.*s\t%s\n", path, (int)(n - 4), name, (check(fd) == 0)?"running":"exited");
+  }
+
+  return 0;
+}
+
+
 int
 main(int argc, char *const argv[]) {
   executable = argv[0];
 
+  char path[PATH_MAX] = {0};
+  struct registry reg __attribute__((cleanup(registry_close))) = {.fd = -1};
+
   int opt, index;
 
   while((opt = getopt_long(argc, argv, "+n:kh", options, &index)) != -1) {
@@ -74,12 +348,54 @@ main(int argc, char *const argv[]) {
       opt_pidfile = optarg;
       break;
 
+    case OPT_BATCH:
+      opt_batch = optarg;
+      break;
+
+    case OPT_REGISTRY:
+      opt_registry = optarg;
+      break;
+
     default:
       break;
     }
   }
 
-  char path[PATH_MAX] = {0};
+  if (opt_registry && (registry_open(&reg, opt_registry, 0) != 0)) {
+    return EXIT_FAILURE;
+  }
+
+  if (opt_batch) {
+    if (opt_kill) {
+      fprintf(stderr, "error: --kill not allowed with --batch\n");
+      goto argument;
+    }
+
+    if (opt_registry) {
+      return (check_registry(&reg, opt_batch) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+    }
+
+    int fd = open(opt_batch, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "error: open '%s', %m\n", opt_batch);
+      return EXIT_FAILURE;
+    }
+
+    if (check_batch(fd, path, 0) != 0) {
+      return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+  }
+
+  if (opt_registry) {
+    if (!opt_pidfile && !opt_name) {
+      fprintf(stderr, "error: missing name\n");
+      goto argument;
+    }
+
+    return (check_registered(&reg, opt_pidfile?opt_pidfile:opt_name) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+  }
 
   if (!opt_pidfile) {
     if (!opt_name) {
@@ -105,47 +421,9 @@ main(int argc, char *const argv[]) {
       return EXIT_FAILURE;
     }
 
-    struct stat buf = {0};
-    if (fstat(fd, &buf) != 0) {
-      fprintf(stderr, "error: stat, %m\n");
+    if (check(fd) != 0) {
       return EXIT_FAILURE;
     }
-
-    off_t len = buf.st_size;
-
-    char s[len+1];
-    if (read(fd, s, len) != len) {
-      fprintf(stderr, "error: read pidfile, %m\n");
-      return EXIT_FAILURE;
-    }
-
-    s[len] = '\0';
-    pid_t pid;
-    if (sscanf(s, "%d", &pid) == EOF) {
-      fprintf(stderr, "error: sscanf pid, %m\n");
-      return EXIT_FAILURE;
-    }
-
-    struct flock lock = {
-      .l_type = F_WRLCK,
-      .l_whence = SEEK_SET,
-      .l_start = 0,
-      .l_len = len,
-    };
-
-    if (fcntl(fd, F_GETLK, &lock) != 0) {
-      fprintf(stderr, "error: test lock pidfile, %m\n");
-      return EXIT_FAILURE;
-    }
-
-    if (lock.l_type == F_UNLCK) {
-      fprintf(stderr, "error: pidfile not locked\n");
-      return EXIT_FAILURE;
-    }
-
-    if (opt_kill) {
-      kill(pid, SIGKILL);
-    }
   }
 
   return EXIT_SUCCESS;
@@ -5,25 +5,42 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sched.h>
-#include <sys/mman.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <linux/limits.h>
 #include <getopt.h>
 
+#include "registry.h"
+#include "trace.h"
+
 #ifndef CLONE_NEWCGROUP
 #define CLONE_NEWCGROUP 0x02000000
 #endif
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 #define OPT_PIDFILE  0
+#define OPT_REGISTRY 1
+#define OPT_CONTEXT  2
+#define OPT_TRACE    3
 
 static char *executable = NULL;
 static char *opt_name = NULL;
 static char *opt_pidfile = NULL;
+static char *opt_registry = NULL;
+static char *opt_context = NULL;
+static char *opt_trace = NULL;
 
 static struct option options[] = {
   {"name",         required_argument, NULL, 'n'},
   {"pidfile",      required_argument, NULL, OPT_PIDFILE},
+  {"registry",     required_argument, NULL, OPT_REGISTRY},
+  {"context",      required_argument, NULL, OPT_CONTEXT},
+  {"trace",        required_argument, NULL, OPT_TRACE},
 
   {"help",         no_argument,       NULL, 'h'},
   {NULL,           no_argument,       NULL, 0}
@@ -36,6 +53,12 @@ show_usage() {
   printf("\n"
          "  -n, --name=NAME            name of the namespace\n"
          "      --pidfile=PIDFILE      path to pidfile\n"
+         "      --registry=FILE        look up PIDFILE, or NAME without --pidfile, in\n"
+         "                             FILE instead\n"
+         "      --context=FILE         take working directory and environment from\n"
+         "                             FILE, instead of the process, if it exists\n"
+         "      --trace=FILE           append a record to FILE as each phase of\n"
+         "                             entering ends, see src/trace.h\n"
          "\n"
          "  -h, --help                 print help message and exit\n"
          );
@@ -72,8 +95,31 @@ open_file(int flags, const char *fmt, ...) {
 }
 
 
+// returns -1 with errno ENOSYS on kernels without pidfd
+int
+_pidfd_open(pid_t pid) {
+  return syscall(SYS_pidfd_open, pid, 0);
+}
+
+
+// ns are inode numbers of namespaces of the process from the registry,
+// or NULL
 int
-enter_ns(pid_t pid) {
+enter_ns(pid_t pid, int pidfd, const uint64_t *ns) {
+  if (pidfd >= 0) {
+    // since Linux 5.8, all namespaces at once, joining the user
+    // namespace we are already in fails with EINVAL
+    static const int all = CLONE_NEWUSER | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWNET | CLONE_NEWCGROUP | CLONE_NEWPID | CLONE_NEWNS;
+
+    if (setns(pidfd, all) == 0) {
+      return 0;
+    }
+
+    if ((errno == EINVAL) && (setns(pidfd, all & ~CLONE_NEWUSER) == 0)) {
+      return 0;
+    }
+  }
+
   static const int mask[] = {
     CLONE_NEWUSER,
     CLONE_NEWUTS,
@@ -107,19 +153,23 @@ enter_ns(pid_t pid) {
 
     ino_t my_ino = buf.st_ino;
 
+    if (ns && (ns[i] == my_ino)) {
+      continue;
+    }
+
     int fd __attribute__((cleanup(cleanup_fd))) = open_file(O_RDONLY|O_CLOEXEC, "/proc/%d/ns/%s", pid, filename[i]);
 
     if (fd < 0) {
-      fprintf(stderr, "error: open '%s' %m\n", path);
       return -1;
     }
 
-    if (fstat(fd, &buf) != 0) {
+    // inode from the registry is known to differ
+    if (!ns && (fstat(fd, &buf) != 0)) {
       fprintf(stderr, "error: stat '%s', %m\n", path);
       return -1;
     }
 
-    ino_t new_ino = buf.st_ino;
+    ino_t new_ino = ns?ns[i]:buf.st_ino;
 
     if (my_ino != new_ino) {
       if (setns(fd, mask[i]) != 0) {
@@ -133,53 +183,115 @@ enter_ns(pid_t pid) {
 }
 
 
-int
-set_environ(pid_t pid) {
-  int fd __attribute__((cleanup(cleanup_fd))) = open_file(O_RDONLY|O_CLOEXEC, "/proc/%d/environ", pid);
-  if (fd < 0) {
-    return -1;
+// reads whole file into a buffer that is never freed, as strings in
+// it are passed to putenv, size of files in /proc is unknown, so the
+// buffer grows until read returns 0
+char *
+read_all(int fd, size_t *size) {
+  struct stat buf = {0};
+  if (fstat(fd, &buf) != 0) {
+    fprintf(stderr, "error: stat, %m\n");
+    return NULL;
   }
 
-  clearenv();
-  size_t size = 0;
-  char *env = NULL;
+  size_t capacity = (buf.st_size > 0)?(buf.st_size + 1):65536;
+  char *data = malloc(capacity);
+  *size = 0;
 
   for(;;) {
-    if (env == NULL) {
-      env = mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-    } else {
-      env = mremap(env, size, size + 4096, MREMAP_MAYMOVE);
-    }
-
-    if (env == MAP_FAILED) {
-      fprintf(stderr, "error: mmap, %m\n");
-      return -1;
+    if (data == NULL) {
+      fprintf(stderr, "error: malloc, %m\n");
+      return NULL;
     }
 
-    ssize_t len = read(fd, env+size, 4096);
+    ssize_t len = read(fd, data + *size, capacity - *size);
     if (len < 0) {
-      fprintf(stderr, "error: read environ, %m\n");
-      return -1;
+      fprintf(stderr, "error: read, %m\n");
+      free(data);
+      return NULL;
     }
 
-    if (len < 4096) {
-      size += len;
+    if (len == 0) {
       break;
     }
 
-    size+=4096;
+    *size += len;
+    if (*size == capacity) {
+      capacity *= 2;
+      char *p = realloc(data, capacity);
+      if (p == NULL) {
+        free(data);
+      }
+      data = p;
+    }
   }
 
-  for(size_t offset=0; offset<size; offset += strlen(env+offset)+1) {
+  return data;
+}
+
+
+void
+put_environ(char *env, size_t size) {
+  clearenv();
+  for(size_t offset=0; offset<size; offset += strnlen(env+offset, size-offset)+1) {
     putenv(env+offset);
   }
+}
+
+
+int
+set_environ(pid_t pid) {
+  int fd __attribute__((cleanup(cleanup_fd))) = open_file(O_RDONLY|O_CLOEXEC, "/proc/%d/environ", pid);
+  if (fd < 0) {
+    return -1;
+  }
+
+  size_t size;
+  char *env = read_all(fd, &size);
+  if (env == NULL) {
+    return -1;
+  }
+
+  put_environ(env, size);
+  return 0;
+}
+
+
+// context is recorded by bin/init when the container is started,
+// working directory followed by environment, each terminated by NUL.
+// returns 0 and sets cwd if loaded, 1 if the file does not exist
+int
+load_context(const char *path, char **cwd) {
+  int fd __attribute__((cleanup(cleanup_fd))) = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return 1;
+    }
+    fprintf(stderr, "error: open '%s', %m\n", path);
+    return -1;
+  }
+
+  size_t size;
+  char *context = read_all(fd, &size);
+  if (context == NULL) {
+    return -1;
+  }
+
+  size_t len = strnlen(context, size);
+  if ((len == 0) || (len == size)) {
+    fprintf(stderr, "error: invalid context '%s'\n", path);
+    free(context);
+    return -1;
+  }
 
+  *cwd = context;
+  put_environ(context + len + 1, size - len - 1);
   return 0;
 }
 
 
 int
-enter(int fd, off_t len) {
+read_pid(int fd, off_t len, pid_t *pid) {
   char buf[len+1];
   if (read(fd, buf, len) != len) {
     fprintf(stderr, "error: read pidfile, %m\n");
@@ -187,28 +299,46 @@ enter(int fd, off_t len) {
   }
 
   buf[len] = '\0';
-  pid_t pid;
-  if (sscanf(buf, "%d", &pid) == EOF) {
+  if (sscanf(buf, "%d", pid) == EOF) {
     fprintf(stderr, "error: sscanf pid, %m\n");
     return -1;
   }
 
-  if(set_environ(pid) != 0) {
+  return 0;
+}
+
+
+int
+enter(pid_t pid, int pidfd, const uint64_t *ns) {
+  trace(TRACE_LOOKUP, pid);
+
+  char *cwd = NULL;
+  int loaded = opt_context?load_context(opt_context, &cwd):1;
+  if (loaded < 0) {
     return -1;
   }
 
-  int wd __attribute__((cleanup(cleanup_fd))) = open_file(O_PATH|O_DIRECTORY|O_CLOEXEC, "/proc/%d/cwd", pid);
-  if (wd < 0) {
-    return -1;
+  int wd __attribute__((cleanup(cleanup_fd))) = -1;
+  if (loaded) {
+    if(set_environ(pid) != 0) {
+      return -1;
+    }
+
+    wd = open_file(O_PATH|O_DIRECTORY|O_CLOEXEC, "/proc/%d/cwd", pid);
+    if (wd < 0) {
+      return -1;
+    }
   }
 
+  trace(TRACE_CONTEXT, pid);
+
   {
     int root __attribute__((cleanup(cleanup_fd))) = open_file(O_PATH|O_DIRECTORY|O_CLOEXEC, "/proc/%d/root", pid);
     if (root < 0) {
       return -1;
     }
 
-    if(enter_ns(pid) != 0) {
+    if(enter_ns(pid, pidfd, ns) != 0) {
       return -1;
     }
 
@@ -224,15 +354,107 @@ enter(int fd, off_t len) {
   }
 
 
-  if (fchdir(wd) != 0) {
+  if (cwd) {
+    if (chdir(cwd) != 0) {
+      fprintf(stderr, "error: chdir '%s', %m\n", cwd);
+      return -1;
+    }
+  } else if (fchdir(wd) != 0) {
     fprintf(stderr, "error: chdir, %m\n");
     return -1;
   }
 
+  trace(TRACE_ENTER, pid);
   return 0;
 }
 
 
+int
+enter_pidfile(const char *pidfile) {
+  int fd __attribute__((cleanup(cleanup_fd))) = open(pidfile, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", pidfile);
+    return -1;
+  }
+
+  struct stat buf = {0};
+  if (fstat(fd, &buf) != 0) {
+    fprintf(stderr, "error: stat, %m\n");
+    return -1;
+  }
+
+  off_t len = buf.st_size;
+
+  pid_t pid;
+  if (read_pid(fd, len, &pid) != 0) {
+    return -1;
+  }
+
+  // the child is reaped only after the pidfile is unlocked, so if
+  // the pidfile is still locked below, pidfd refers to the child
+  int pidfd __attribute__((cleanup(cleanup_fd))) = _pidfd_open(pid);
+  if ((pidfd < 0) && (errno != ENOSYS)) {
+    fprintf(stderr, "error: pidfd_open, %m\n");
+    return -1;
+  }
+
+  struct flock lock = {
+    .l_type = F_WRLCK,
+    .l_whence = SEEK_SET,
+    .l_start = 0,
+    .l_len = len,
+  };
+
+  if (fcntl(fd, F_GETLK, &lock) != 0) {
+    fprintf(stderr, "error: test lock pidfile, %m\n");
+    return -1;
+  }
+
+  if (lock.l_type == F_UNLCK) {
+    fprintf(stderr, "error: pidfile not locked\n");
+    return -1;
+  }
+
+  return enter(pid, pidfd, NULL);
+}
+
+
+int
+enter_registered(const char *path, const char *key) {
+  struct registry reg __attribute__((cleanup(registry_close))) = {.fd = -1};
+  if (registry_open(&reg, path, 0) != 0) {
+    return -1;
+  }
+
+  struct registry_entry entry;
+  ssize_t slot = registry_lookup(&reg, key, &entry);
+  if (slot < 0) {
+    fprintf(stderr, "error: '%s' not registered\n", key);
+    return -1;
+  }
+
+  if (!registry_alive(&entry)) {
+    fprintf(stderr, "error: owner of '%s' died\n", key);
+    return -1;
+  }
+
+  // the child is removed from the registry before it is reaped, so
+  // if the entry is unchanged below, pidfd refers to the child
+  int pidfd __attribute__((cleanup(cleanup_fd))) = _pidfd_open(entry.pid);
+  if ((pidfd < 0) && (errno != ENOSYS)) {
+    fprintf(stderr, "error: pidfd_open, %m\n");
+    return -1;
+  }
+
+  if (!registry_unchanged(&reg, slot, &entry)) {
+    fprintf(stderr, "error: process exited\n");
+    return -1;
+  }
+
+  return enter(entry.pid, pidfd, entry.ns);
+}
+
+
 pid_t
 spawn_process(char *const argv[]) {
   pid_t pid = fork();
@@ -242,10 +464,16 @@ spawn_process(char *const argv[]) {
     return -1;
   }
 
+  if (pid) {
+    trace(TRACE_CLONE, pid);
+  }
+
   if (pid == 0) {
+    trace(TRACE_EXEC, 0);
     execvp(argv[0], argv);
     fprintf(stderr, "error: exec, %m\n");
-    exit(EXIT_FAILURE);
+    // same as shell, so that callers can tell from exit code
+    exit((errno == ENOENT)?127:126);
   }
 
   return pid;
@@ -275,62 +503,53 @@ main(int argc, char *const argv[]) {
       opt_pidfile = optarg;
       break;
 
-    default:
+    case OPT_REGISTRY:
+      opt_registry = optarg;
       break;
-    }
-  }
 
-  char path[PATH_MAX] = {0};
+    case OPT_CONTEXT:
+      opt_context = optarg;
+      break;
 
-  if (!opt_pidfile) {
-    if (!opt_name) {
-      fprintf(stderr, "error: missing name\n");
-      goto argument;
-    }
+    case OPT_TRACE:
+      opt_trace = optarg;
+      break;
 
-    char *rundir = getenv("XDG_RUNTIME_DIR");
-    if (!rundir) {
-      fprintf(stderr, "error: environment XDG_RUNTIME_DIR not set\n");
-      return EXIT_FAILURE;
+    default:
+      break;
     }
-    snprintf(path, PATH_MAX, "%s/userns/%s", rundir, opt_name);
+  }
 
-    opt_pidfile = path;
+  if (!opt_pidfile && !opt_name) {
+    fprintf(stderr, "error: missing name\n");
+    goto argument;
   }
 
-  {
-    int fd __attribute__((cleanup(cleanup_fd))) = open(opt_pidfile, O_RDONLY|O_CLOEXEC);
-    if (fd < 0) {
-      fprintf(stderr, "error: open '%s', %m\n", opt_pidfile);
-      return EXIT_FAILURE;
-    }
+  if (opt_trace && (trace_open(opt_trace, opt_pidfile?opt_pidfile:opt_name) != 0)) {
+    return EXIT_FAILURE;
+  }
 
-    struct stat buf = {0};
-    if (fstat(fd, &buf) != 0) {
-      fprintf(stderr, "error: stat, %m\n");
-      return EXIT_FAILURE;
-    }
+  trace(TRACE_START, 0);
 
-    off_t len = buf.st_size;
+  char path[PATH_MAX] = {0};
 
-    if (enter(fd, len) != 0) {
+  if (opt_registry) {
+    if (enter_registered(opt_registry, opt_pidfile?opt_pidfile:opt_name) != 0) {
       return EXIT_FAILURE;
     }
+  } else {
+    if (!opt_pidfile) {
+      char *rundir = getenv("XDG_RUNTIME_DIR");
+      if (!rundir) {
+        fprintf(stderr, "error: environment XDG_RUNTIME_DIR not set\n");
+        return EXIT_FAILURE;
+      }
+      snprintf(path, PATH_MAX, "%s/userns/%s", rundir, opt_name);
 
-    struct flock lock = {
-      .l_type = F_WRLCK,
-      .l_whence = SEEK_SET,
-      .l_start = 0,
-      .l_len = len,
-    };
-
-    if (fcntl(fd, F_GETLK, &lock) != 0) {
-      fprintf(stderr, "error: test lock pidfile, %m\n");
-      return EXIT_FAILURE;
+      opt_pidfile = path;
     }
 
-    if (lock.l_type == F_UNLCK) {
-      fprintf(stderr, "error: pidfile not locked\n");
+    if (enter_pidfile(opt_pidfile) != 0) {
       return EXIT_FAILURE;
     }
   }
@@ -340,14 +559,15 @@ main(int argc, char *const argv[]) {
     pid = spawn_process(argv + optind);
   } else {
     char *shell = getenv("SHELL");
-    char *argv[2] = {shell?shell:"/bin/sh", NULL};
-    pid = spawn_process(argv);
+    char *shell_argv[2] = {shell?shell:"/bin/sh", NULL};
+    pid = spawn_process(shell_argv);
   }
 
   if (pid < 0) {
     return EXIT_FAILURE;
   }
 
+  trace_close();
   close(STDIN_FILENO);
   close(STDOUT_FILENO);
 
@@ -0,0 +1,640 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+#include <getopt.h>
+
+// exec helper of a container. unspawn --exec-socket starts it in the
+// namespaces of the container, right before exec of the container,
+// so that commands requested on the socket are forked from here,
+// without entering namespaces for each of them. a request is the
+// same as one to the unspawn daemon, NUL terminated arguments along
+// with stdin, stdout and stderr, the pid is replied, and then the
+// exit code once the command exits. when the client disconnects
+// before that, the process group of the command is killed.
+
+#define OPT_LISTEN   0
+#define OPT_CONNECT  1
+#define OPT_CONTEXT  2
+
+#define MAX_COMMANDS 256
+
+static char *executable = NULL;
+static char *opt_listen = NULL;
+static char *opt_connect = NULL;
+static char *opt_context = NULL;
+
+static struct option options[] = {
+  {"listen",       required_argument, NULL, OPT_LISTEN},
+  {"connect",      required_argument, NULL, OPT_CONNECT},
+  {"context",      required_argument, NULL, OPT_CONTEXT},
+
+  {"help",         no_argument,       NULL, 'h'},
+  {NULL,           no_argument,       NULL, 0}
+};
+
+
+void
+show_usage() {
+  printf("Usage: %s [options] [--] [command]\n", executable);
+  printf("\n"
+         "      --listen=SOCKET        run commands requested on SOCKET\n"
+         "      --context=FILE         with --listen, take working directory and\n"
+         "                             environment of commands from FILE, if exists\n"
+         "      --connect=SOCKET       ask helper listening on SOCKET to run command,\n"
+         "                             and exit with its exit code\n"
+         "\n"
+         "  -h, --help                 print help message and exit\n"
+         );
+  exit(EXIT_SUCCESS);
+}
+
+
+void
+cleanup_fd(int *fd) {
+  if (*fd < 0)
+    return;
+  close(*fd);
+}
+
+
+// same as unenter, the buffer is never freed, as strings in it are
+// passed to putenv
+char *
+read_all(int fd, size_t *size) {
+  struct stat buf = {0};
+  if (fstat(fd, &buf) != 0) {
+    fprintf(stderr, "error: stat, %m\n");
+    return NULL;
+  }
+
+  size_t capacity = (buf.st_size > 0)?(buf.st_size + 1):4096;
+  char *data = malloc(capacity);
+  *size = 0;
+
+  for(;;) {
+    if (data == NULL) {
+      fprintf(stderr, "error: malloc, %m\n");
+      return NULL;
+    }
+
+    ssize_t len = read(fd, data + *size, capacity - *size);
+    if (len < 0) {
+      fprintf(stderr, "error: read, %m\n");
+      free(data);
+      return NULL;
+    }
+
+    if (len == 0) {
+      break;
+    }
+
+    *size += len;
+    if (*size == capacity) {
+      capacity *= 2;
+      char *p = realloc(data, capacity);
+      if (p == NULL) {
+        free(data);
+      }
+      data = p;
+    }
+  }
+
+  return data;
+}
+
+
+// context is recorded by bin/init, working directory followed by
+// environment, each terminated by NUL. it is loaded in the forked
+// child for each command, as it is only written after the helper
+// is started
+int
+load_context(const char *path) {
+  int fd __attribute__((cleanup(cleanup_fd))) = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    fprintf(stderr, "error: open '%s', %m\n", path);
+    return -1;
+  }
+
+  size_t size;
+  char *context = read_all(fd, &size);
+  if (context == NULL) {
+    return -1;
+  }
+
+  size_t len = strnlen(context, size);
+  if ((len == 0) || (len == size)) {
+    fprintf(stderr, "error: invalid context '%s'\n", path);
+    return -1;
+  }
+
+  if (chdir(context) != 0) {
+    fprintf(stderr, "error: chdir '%s', %m\n", context);
+    return -1;
+  }
+
+  clearenv();
+  for(size_t offset=len+1; offset<size; offset += strnlen(context+offset, size-offset)+1) {
+    putenv(context+offset);
+  }
+
+  return 0;
+}
+
+
+struct command {
+  pid_t pid;
+  // -1 once the client is gone
+  int fd;
+};
+
+static struct command commands[MAX_COMMANDS];
+static size_t ncommands = 0;
+
+
+struct command *
+find_command(pid_t pid, int fd) {
+  for(size_t i=0; i<ncommands; i++) {
+    if ((pid > 0) && (commands[i].pid == pid)) {
+      return commands + i;
+    }
+
+    if ((fd >= 0) && (commands[i].fd == fd)) {
+      return commands + i;
+    }
+  }
+
+  return NULL;
+}
+
+
+void
+reap_commands(int efd) {
+  for(;;) {
+    int status;
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+    if (pid <= 0) {
+      return;
+    }
+
+    // orphans of commands are reaped as well, as the helper is a
+    // subreaper
+    struct command *c = find_command(pid, -1);
+    if (c == NULL) {
+      continue;
+    }
+
+    if (c->fd >= 0) {
+      int code = WIFSIGNALED(status)?(WTERMSIG(status) + 128):WEXITSTATUS(status);
+
+      char reply[16] = {0};
+      int n = snprintf(reply, sizeof(reply), "%d", code);
+      send(c->fd, reply, n, MSG_NOSIGNAL);
+      epoll_ctl(efd, EPOLL_CTL_DEL, c->fd, NULL);
+      close(c->fd);
+    }
+
+    *c = commands[--ncommands];
+  }
+}
+
+
+void
+run_command(char *const argv[], const int stdio[3], const sigset_t *oldset) {
+  if (sigprocmask(SIG_SETMASK, oldset, NULL) != 0) {
+    fprintf(stderr, "error: set signal mask, %m\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (setsid() < 0) {
+    fprintf(stderr, "error: setsid, %m\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(int i=0; i<3; i++) {
+    if (dup2(stdio[i], i) < 0) {
+      fprintf(stderr, "error: dup stdio, %m\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (opt_context && (load_context(opt_context) != 0)) {
+    exit(EXIT_FAILURE);
+  }
+
+  execvp(argv[0], argv);
+  fprintf(stderr, "error: exec, %m\n");
+  exit((errno == ENOENT)?127:126);
+}
+
+
+// returns 0 if client closed the connection, -1 on error, 1 if
+// command is started
+int
+handle_request(int fd, const sigset_t *oldset) {
+  char buf[65536];
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * 3)];
+  } control;
+
+  struct iovec iov = {
+    .iov_base = buf,
+    .iov_len = sizeof(buf) - 1,
+  };
+
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+
+  ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (len < 0) {
+    fprintf(stderr, "error: recvmsg, %m\n");
+    return -1;
+  }
+
+  if (len == 0) {
+    return 0;
+  }
+
+  int fds[3] = {-1, -1, -1};
+  int nfds = 0;
+
+  for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+      continue;
+    }
+
+    nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * ((nfds < 3)?nfds:3));
+  }
+
+  pid_t pid = -1;
+
+  if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
+    fprintf(stderr, "error: request truncated\n");
+  } else if (nfds != 3) {
+    fprintf(stderr, "error: expect 3 file descriptors, got %d\n", nfds);
+  } else if (ncommands == MAX_COMMANDS) {
+    fprintf(stderr, "error: too many commands\n");
+  } else if (buf[len-1] != '\0') {
+    fprintf(stderr, "error: invalid request\n");
+  } else {
+    buf[len] = '\0';
+
+    int argc = 0;
+    for(ssize_t i=0; i<len; i++) {
+      argc += (buf[i] == '\0');
+    }
+
+    char *argv[argc+1];
+    argc = 0;
+    for(ssize_t i=0; i<len; i += strlen(buf+i)+1) {
+      argv[argc++] = buf+i;
+    }
+    argv[argc] = NULL;
+
+    pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "error: fork, %m\n");
+    } else if (pid == 0) {
+      run_command(argv, fds, oldset);
+    } else {
+      commands[ncommands].pid = pid;
+      commands[ncommands].fd = fd;
+      ncommands++;
+    }
+  }
+
+  for(int i=0; i<3; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+
+  char reply[16] = {0};
+  int n = snprintf(reply, sizeof(reply), "%d", pid);
+  if (send(fd, reply, n, MSG_NOSIGNAL) != n) {
+    fprintf(stderr, "error: send reply, %m\n");
+    if (pid > 0) {
+      kill(-pid, SIGKILL);
+      find_command(pid, -1)->fd = -1;
+    }
+    return -1;
+  }
+
+  return (pid > 0)?1:-1;
+}
+
+
+int
+listen_socket(const char *path) {
+  struct sockaddr_un addr = {
+    .sun_family = AF_UNIX,
+  };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: socket path too long '%s'\n", path);
+    return -1;
+  }
+
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "error: socket, %m\n");
+    return -1;
+  }
+
+  if ((unlink(path) != 0) && (errno != ENOENT)) {
+    fprintf(stderr, "error: unlink '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "error: bind '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  if (listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "error: listen '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+int
+epoll_add(int efd, int fd) {
+  struct epoll_event event = {
+    .events = EPOLLIN,
+    .data.fd = fd,
+  };
+
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &event) != 0) {
+    fprintf(stderr, "error: epoll_ctl, %m\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int
+serve(const char *path) {
+  sigset_t set, oldset;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+
+  if(sigprocmask(SIG_BLOCK, &set, &oldset) != 0) {
+    fprintf(stderr, "set signal mask, %m\n");
+    return -1;
+  }
+
+  if (prctl(PR_SET_CHILD_SUBREAPER, 1) != 0) {
+    fprintf(stderr, "error: set child subreaper, %m\n");
+    return -1;
+  }
+
+  int sfd __attribute__((cleanup(cleanup_fd))) = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC);
+  if (sfd < 0) {
+    fprintf(stderr, "error: create signalfd, %m\n");
+    return -1;
+  }
+
+  int lfd __attribute__((cleanup(cleanup_fd))) = listen_socket(path);
+  if (lfd < 0) {
+    return -1;
+  }
+
+  int efd __attribute__((cleanup(cleanup_fd))) = epoll_create1(EPOLL_CLOEXEC);
+  if (efd < 0) {
+    fprintf(stderr, "error: epoll_create, %m\n");
+    return -1;
+  }
+
+  if ((epoll_add(efd, sfd) != 0) || (epoll_add(efd, lfd) != 0)) {
+    return -1;
+  }
+
+  for(;;) {
+    struct epoll_event events[16];
+    int n = epoll_wait(efd, events, 16, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "error: epoll_wait, %m\n");
+      return -1;
+    }
+
+    for(int i=0; i<n; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == sfd) {
+        struct signalfd_siginfo fdsi;
+        while (read(sfd, &fdsi, sizeof(fdsi)) == sizeof(fdsi));
+        reap_commands(efd);
+      } else if (fd == lfd) {
+        int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd < 0) {
+          fprintf(stderr, "error: accept, %m\n");
+          continue;
+        }
+
+        if (epoll_add(efd, cfd) != 0) {
+          close(cfd);
+        }
+      } else {
+        // clients send nothing after the request, so the connection
+        // of a running command is readable only when closed
+        struct command *c = find_command(-1, fd);
+        if (c != NULL) {
+          kill(-c->pid, SIGKILL);
+          c->fd = -1;
+        } else if (handle_request(fd, &oldset) > 0) {
+          continue;
+        }
+
+        epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+      }
+    }
+  }
+}
+
+
+int
+request(const char *path, int argc, char *const argv[]) {
+  char buf[65536];
+  size_t len = 0;
+
+  for(int i=0; i<argc; i++) {
+    size_t n = strlen(argv[i]) + 1;
+    if (len + n > sizeof(buf)) {
+      fprintf(stderr, "error: arguments too long\n");
+      return -1;
+    }
+
+    memcpy(buf + len, argv[i], n);
+    len += n;
+  }
+
+  struct sockaddr_un addr = {
+    .sun_family = AF_UNIX,
+  };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: socket path too long '%s'\n", path);
+    return -1;
+  }
+
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd __attribute__((cleanup(cleanup_fd))) = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "error: socket, %m\n");
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "error: connect '%s', %m\n", path);
+    return -1;
+  }
+
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * 3)];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct iovec iov = {
+    .iov_base = buf,
+    .iov_len = len,
+  };
+
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+  static const int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+    fprintf(stderr, "error: sendmsg, %m\n");
+    return -1;
+  }
+
+  char reply[16] = {0};
+  if (recv(fd, reply, sizeof(reply) - 1, 0) <= 0) {
+    fprintf(stderr, "error: recv reply, %m\n");
+    return -1;
+  }
+
+  pid_t pid;
+  if ((sscanf(reply, "%d", &pid) != 1) || (pid < 0)) {
+    fprintf(stderr, "error: helper failed to run command\n");
+    return -1;
+  }
+
+  memset(reply, 0, sizeof(reply));
+  if (recv(fd, reply, sizeof(reply) - 1, 0) <= 0) {
+    fprintf(stderr, "error: recv exit code, %m\n");
+    return -1;
+  }
+
+  int code;
+  if (sscanf(reply, "%d", &code) != 1) {
+    fprintf(stderr, "error: invalid exit code\n");
+    return -1;
+  }
+
+  return code;
+}
+
+
+int
+main(int argc, char *const argv[]) {
+  executable = argv[0];
+
+  int opt, index;
+
+  while((opt = getopt_long(argc, argv, "+h", options, &index)) != -1) {
+    switch(opt) {
+    case '?':
+      goto argument;
+
+    case 'h':
+      show_usage();
+      break;
+
+    case OPT_LISTEN:
+      opt_listen = optarg;
+      break;
+
+    case OPT_CONNECT:
+      opt_connect = optarg;
+      break;
+
+    case OPT_CONTEXT:
+      opt_context = optarg;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  if (opt_listen) {
+    serve(opt_listen);
+    return EXIT_FAILURE;
+  }
+
+  if (!opt_connect) {
+    fprintf(stderr, "error: missing --listen or --connect\n");
+    goto argument;
+  }
+
+  int code;
+  if (optind < argc) {
+    code = request(opt_connect, argc - optind, argv + optind);
+  } else {
+    char *shell = getenv("SHELL");
+    char *shell_argv[2] = {shell?shell:"/bin/sh", NULL};
+    code = request(opt_connect, 1, shell_argv);
+  }
+
+  return (code < 0)?EXIT_FAILURE:code;
+
+argument:
+  fprintf(stderr, "Try '%s --help'\n", executable);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <linux/limits.h>
+#include <getopt.h>
+
+// the cluster CIDR is split into subnets of --node-prefix, one per
+// node, the first one is left to the gateway and DHCP. the subnet of
+// a node is assigned on first use, and recorded in DIR/nodes. leases
+// of a node are bits of a bitmap in DIR/NODE, taken and given back
+// with atomic operations, so that pods are not serialized on a lock.
+
+#define IPAM_MAGIC    0x4d415049
+#define NODE_NAME_MAX 64
+
+#define OPT_CIDR       0
+#define OPT_NODEPREFIX 1
+#define OPT_DIR        2
+
+static char *executable = NULL;
+static char *opt_node = NULL;
+static char *opt_cidr = "10.0.0.0/16";
+static int opt_node_prefix = 24;
+static char *opt_dir = "/run/ipam";
+
+
+static struct option options[] = {
+  {"node",         required_argument, NULL, 'n'},
+  {"cidr",         required_argument, NULL, OPT_CIDR},
+  {"node-prefix",  required_argument, NULL, OPT_NODEPREFIX},
+  {"dir",          required_argument, NULL, OPT_DIR},
+
+  {"help",         no_argument,       NULL, 'h'},
+  {NULL,           no_argument,       NULL, 0}
+};
+
+
+void
+show_usage() {
+  printf("Usage: %s [options] allocate|release [ADDR]\n", executable);
+  printf("\n"
+         "allocate prints a free address of the subnet of NODE, as ADDR/PREFIX\n"
+         "with PREFIX of the cluster CIDR. release gives ADDR back.\n"
+         "\n"
+         "  -n, --node=NODE            name of the node\n"
+         "      --cidr=CIDR            cluster CIDR, default 10.0.0.0/16\n"
+         "      --node-prefix=LEN      prefix length of subnet of a node, default 24\n"
+         "      --dir=DIR              where leases are kept, default /run/ipam\n"
+         "\n"
+         "  -h, --help                 print help message and exit\n"
+         );
+  exit(EXIT_SUCCESS);
+}
+
+
+void
+cleanup_fd(int *fd) {
+  if (*fd < 0)
+    return;
+  close(*fd);
+}
+
+
+struct header {
+  uint32_t magic;
+  uint32_t network;
+  uint32_t prefix;
+  uint32_t node_prefix;
+};
+
+// DIR/nodes, name of the node of each subnet
+struct nodes {
+  struct header header;
+  char name[][NODE_NAME_MAX];
+};
+
+// DIR/NODE
+struct leases {
+  struct header header;
+  uint32_t subnet;
+  uint32_t hint;
+  uint64_t bits[];
+};
+
+static uint32_t network = 0;
+static int prefix = 0;
+
+
+int
+parse_cidr(const char *s) {
+  char buf[INET_ADDRSTRLEN + 4] = {0};
+  strncpy(buf, s, sizeof(buf) - 1);
+
+  char *slash = strchr(buf, '/');
+  if (slash == NULL) {
+    fprintf(stderr, "error: missing prefix length '%s'\n", s);
+    return -1;
+  }
+
+  *slash = '\0';
+  char *end;
+  prefix = strtol(slash + 1, &end, 10);
+  if ((*end != '\0') || (prefix < 1) || (prefix > 30)) {
+    fprintf(stderr, "error: invalid prefix length '%s'\n", s);
+    return -1;
+  }
+
+  struct in_addr addr;
+  if (inet_pton(AF_INET, buf, &addr) != 1) {
+    fprintf(stderr, "error: invalid address '%s'\n", s);
+    return -1;
+  }
+
+  network = ntohl(addr.s_addr) & ~((1u << (32 - prefix)) - 1);
+  return 0;
+}
+
+
+size_t
+nsubnets() {
+  return (size_t)1 << (opt_node_prefix - prefix);
+}
+
+
+size_t
+nhosts() {
+  return (size_t)1 << (32 - opt_node_prefix);
+}
+
+
+size_t
+leases_size() {
+  return sizeof(struct leases) + ((nhosts() + 63) / 64) * sizeof(uint64_t);
+}
+
+
+int
+check_header(const struct header *header, const char *path) {
+  if ((header->magic != IPAM_MAGIC) ||
+      (header->network != network) ||
+      (header->prefix != (uint32_t)prefix) ||
+      (header->node_prefix != (uint32_t)opt_node_prefix)) {
+    fprintf(stderr, "error: '%s' belongs to another cluster CIDR\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+// returns the subnet assigned to the node, assigning a free one if
+// there is none yet, the caller holds lock of DIR/nodes
+int
+assign_subnet(int fd, const char *path) {
+  size_t size = sizeof(struct nodes) + nsubnets() * NODE_NAME_MAX;
+
+  struct stat buf = {0};
+  if (fstat(fd, &buf) != 0) {
+    fprintf(stderr, "error: stat '%s', %m\n", path);
+    return -1;
+  }
+
+  if (buf.st_size == 0) {
+    struct header header = {
+      .magic = IPAM_MAGIC,
+      .network = network,
+      .prefix = prefix,
+      .node_prefix = opt_node_prefix,
+    };
+
+    if ((ftruncate(fd, size) != 0) || (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))) {
+      fprintf(stderr, "error: initialize '%s', %m\n", path);
+      return -1;
+    }
+  } else if ((size_t)buf.st_size != size) {
+    fprintf(stderr, "error: '%s' belongs to another cluster CIDR\n", path);
+    return -1;
+  }
+
+  struct nodes *nodes = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (nodes == MAP_FAILED) {
+    fprintf(stderr, "error: mmap '%s', %m\n", path);
+    return -1;
+  }
+
+  int subnet = -1;
+
+  if (check_header(&nodes->header, path) == 0) {
+    for(size_t i=1; i<nsubnets(); i++) {
+      if (strncmp(nodes->name[i], opt_node, NODE_NAME_MAX) == 0) {
+        subnet = i;
+        break;
+      }
+
+      if ((subnet == -1) && (nodes->name[i][0] == '\0')) {
+        subnet = -1 - i;
+      }
+    }
+
+    if (subnet < -1) {
+      subnet = -1 - subnet;
+      strncpy(nodes->name[subnet], opt_node, NODE_NAME_MAX - 1);
+    } else if (subnet == -1) {
+      fprintf(stderr, "error: no subnet left for node '%s'\n", opt_node);
+    }
+  }
+
+  munmap(nodes, size);
+  return subnet;
+}
+
+
+// creates DIR/NODE, renamed into place when complete
+int
+create_leases(const char *path) {
+  char nodes_path[PATH_MAX] = {0};
+  snprintf(nodes_path, PATH_MAX, "%s/nodes", opt_dir);
+
+  int fd __attribute__((cleanup(cleanup_fd))) = open(nodes_path, O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR);
+  if (fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", nodes_path);
+    return -1;
+  }
+
+  if (flock(fd, LOCK_EX) != 0) {
+    fprintf(stderr, "error: lock '%s', %m\n", nodes_path);
+    return -1;
+  }
+
+  if (access(path, F_OK) == 0) {
+    return 0;
+  }
+
+  int subnet = assign_subnet(fd, nodes_path);
+  if (subnet < 0) {
+    return -1;
+  }
+
+  char tmp[PATH_MAX] = {0};
+  snprintf(tmp, PATH_MAX, "%s.tmp", path);
+
+  int lfd __attribute__((cleanup(cleanup_fd))) = open(tmp, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+  if (lfd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", tmp);
+    return -1;
+  }
+
+  size_t size = leases_size();
+  if (ftruncate(lfd, size) != 0) {
+    fprintf(stderr, "error: truncate '%s', %m\n", tmp);
+    return -1;
+  }
+
+  struct leases *leases = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, lfd, 0);
+  if (leases == MAP_FAILED) {
+    fprintf(stderr, "error: mmap '%s', %m\n", tmp);
+    return -1;
+  }
+
+  leases->header.magic = IPAM_MAGIC;
+  leases->header.network = network;
+  leases->header.prefix = prefix;
+  leases->header.node_prefix = opt_node_prefix;
+  leases->subnet = subnet;
+
+  // network and broadcast address of the subnet, and bits past the
+  // end of it, are never handed out
+  size_t n = nhosts();
+  leases->bits[0] |= 1;
+  leases->bits[(n - 1) / 64] |= 1ull << ((n - 1) % 64);
+  for(size_t i=n; i % 64; i++) {
+    leases->bits[i / 64] |= 1ull << (i % 64);
+  }
+
+  munmap(leases, size);
+
+  if (rename(tmp, path) != 0) {
+    fprintf(stderr, "error: rename '%s', %m\n", tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+struct leases *
+open_leases() {
+  if ((mkdir(opt_dir, S_IRWXU) != 0) && (errno != EEXIST)) {
+    fprintf(stderr, "error: mkdir '%s', %m\n", opt_dir);
+    return NULL;
+  }
+
+  char path[PATH_MAX] = {0};
+  snprintf(path, PATH_MAX, "%s/%s", opt_dir, opt_node);
+
+  int fd __attribute__((cleanup(cleanup_fd))) = open(path, O_RDWR|O_CLOEXEC);
+  if ((fd < 0) && (errno == ENOENT)) {
+    if (create_leases(path) != 0) {
+      return NULL;
+    }
+
+    fd = open(path, O_RDWR|O_CLOEXEC);
+  }
+
+  if (fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", path);
+    return NULL;
+  }
+
+  struct stat buf = {0};
+  if (fstat(fd, &buf) != 0) {
+    fprintf(stderr, "error: stat '%s', %m\n", path);
+    return NULL;
+  }
+
+  if ((size_t)buf.st_size != leases_size()) {
+    fprintf(stderr, "error: '%s' belongs to another cluster CIDR\n", path);
+    return NULL;
+  }
+
+  struct leases *leases = mmap(NULL, leases_size(), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (leases == MAP_FAILED) {
+    fprintf(stderr, "error: mmap '%s', %m\n", path);
+    return NULL;
+  }
+
+  if (check_header(&leases->header, path) != 0) {
+    return NULL;
+  }
+
+  return leases;
+}
+
+
+int
+allocate(struct leases *leases) {
+  size_t nwords = (nhosts() + 63) / 64;
+  size_t start = __atomic_load_n(&leases->hint, __ATOMIC_RELAXED) % nwords;
+
+  for(size_t i=0; i<nwords; i++) {
+    size_t w = (start + i) % nwords;
+    uint64_t bits = __atomic_load_n(&leases->bits[w], __ATOMIC_RELAXED);
+
+    while (~bits) {
+      int bit = __builtin_ctzll(~bits);
+      if (__atomic_compare_exchange_n(&leases->bits[w], &bits, bits | (1ull << bit), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&leases->hint, w, __ATOMIC_RELAXED);
+
+        struct in_addr addr = {
+          .s_addr = htonl(network + leases->subnet * nhosts() + w * 64 + bit),
+        };
+
+        char buf[INET_ADDRSTRLEN] = {0};
+        printf("%s/%d\n", inet_ntop(AF_INET, &addr, buf, sizeof(buf)), prefix);
+        return 0;
+      }
+    }
+  }
+
+  fprintf(stderr, "error: no address left for node '%s'\n", opt_node);
+  return -1;
+}
+
+
+int
+release(struct leases *leases, const char *s) {
+  char buf[INET_ADDRSTRLEN + 4] = {0};
+  strncpy(buf, s, sizeof(buf) - 1);
+
+  char *slash = strchr(buf, '/');
+  if (slash) {
+    *slash = '\0';
+  }
+
+  struct in_addr addr;
+  if (inet_pton(AF_INET, buf, &addr) != 1) {
+    fprintf(stderr, "error: invalid address '%s'\n", s);
+    return -1;
+  }
+
+  uint32_t base = network + leases->subnet * nhosts();
+  uint32_t host = ntohl(addr.s_addr) - base;
+
+  if ((ntohl(addr.s_addr) < base) || (host == 0) || (host >= nhosts() - 1)) {
+    fprintf(stderr, "error: '%s' not in subnet of node '%s'\n", s, opt_node);
+    return -1;
+  }
+
+  uint64_t mask = 1ull << (host % 64);
+  if (!(__atomic_fetch_and(&leases->bits[host / 64], ~mask, __ATOMIC_ACQ_REL) & mask)) {
+    fprintf(stderr, "error: '%s' not allocated\n", s);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int
+main(int argc, char *const argv[]) {
+  executable = argv[0];
+
+  int opt, index;
+
+  while((opt = getopt_long(argc, argv, "+n:h", options, &index)) != -1) {
+    switch(opt) {
+    case '?':
+      goto argument;
+
+    case 'h':
+      show_usage();
+      break;
+
+    case 'n':
+      opt_node = optarg;
+      break;
+
+    case OPT_CIDR:
+      opt_cidr = optarg;
+      break;
+
+    case OPT_NODEPREFIX:
+      opt_node_prefix = atoi(optarg);
+      break;
+
+    case OPT_DIR:
+      opt_dir = optarg;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  if (!opt_node) {
+    fprintf(stderr, "error: missing node\n");
+    goto argument;
+  }
+
+  if (strchr(opt_node, '/') || (strlen(opt_node) >= NODE_NAME_MAX) || (strcmp(opt_node, "nodes") == 0)) {
+    fprintf(stderr, "error: invalid node '%s'\n", opt_node);
+    goto argument;
+  }
+
+  if (parse_cidr(opt_cidr) != 0) {
+    goto argument;
+  }
+
+  if ((opt_node_prefix <= prefix) || (opt_node_prefix > 30) || (opt_node_prefix - prefix > 16)) {
+    fprintf(stderr, "error: invalid node prefix length %d\n", opt_node_prefix);
+    goto argument;
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "error: missing command\n");
+    goto argument;
+  }
+
+  if (strcmp(argv[optind], "allocate") == 0) {
+    struct leases *leases = open_leases();
+    if (leases == NULL) {
+      return EXIT_FAILURE;
+    }
+
+    return (allocate(leases) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+  }
+
+  if (strcmp(argv[optind], "release") == 0) {
+    if (optind + 1 >= argc) {
+      fprintf(stderr, "error: missing address\n");
+      goto argument;
+    }
+
+    struct leases *leases = open_leases();
+    if (leases == NULL) {
+      return EXIT_FAILURE;
+    }
+
+    return (release(leases, argv[optind+1]) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+  }
+
+  fprintf(stderr, "error: unknown command '%s'\n", argv[optind]);
+
+argument:
+  fprintf(stderr, "Try '%s --help'\n", executable);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/limits.h>
+#include <getopt.h>
+
+#ifndef MACVLAN_MODE_BRIDGE
+#define MACVLAN_MODE_BRIDGE 4
+#endif
+
+#define NETNS_RUN_DIR "/var/run/netns"
+
+#define OPT_LINK       0
+#define OPT_LINKNETNS  1
+#define OPT_IFNAME     2
+#define OPT_ADDRESS    3
+#define OPT_GATEWAY    4
+
+static char *executable = NULL;
+static char *opt_name = NULL;
+static char *opt_link = "br1";
+static char *opt_link_netns = "dnsmasq";
+static char *opt_ifname = "eth0";
+static char *opt_address = NULL;
+static char *opt_gateway = NULL;
+
+
+static struct option options[] = {
+  {"name",         required_argument, NULL, 'n'},
+  {"link",         required_argument, NULL, OPT_LINK},
+  {"link-netns",   required_argument, NULL, OPT_LINKNETNS},
+  {"ifname",       required_argument, NULL, OPT_IFNAME},
+  {"address",      required_argument, NULL, OPT_ADDRESS},
+  {"gateway",      required_argument, NULL, OPT_GATEWAY},
+
+  {"help",         no_argument,       NULL, 'h'},
+  {NULL,           no_argument,       NULL, 0}
+};
+
+
+void
+show_usage() {
+  printf("Usage: %s [options]\n", executable);
+  printf("\n"
+         "Create network namespace NAME, same as 'ip netns add', with a macvlan\n"
+         "of LINK in NETNS, and set up its links and address over rtnetlink.\n"
+         "\n"
+         "  -n, --name=NAME            name of the network namespace\n"
+         "      --link=LINK            parent of macvlan, default br1\n"
+         "      --link-netns=NETNS     network namespace of LINK, default dnsmasq\n"
+         "      --ifname=IFNAME        name of macvlan in NAME, default eth0\n"
+         "      --address=ADDR/PREFIX  assign IPv4 address to IFNAME\n"
+         "      --gateway=ADDR         add default route via ADDR\n"
+         "\n"
+         "  -h, --help                 print help message and exit\n"
+         );
+  exit(EXIT_SUCCESS);
+}
+
+
+void
+cleanup_fd(int *fd) {
+  if (*fd < 0)
+    return;
+  close(*fd);
+}
+
+
+// several rtnetlink messages sent at once, each one acknowledged
+struct request {
+  char buf[4096];
+  size_t len;
+  unsigned int seq;
+  const char *what[16];
+};
+
+
+struct nlmsghdr *
+add_message(struct request *req, int type, int flags, const void *data, size_t len, const char *what) {
+  size_t size = NLMSG_SPACE(len);
+
+  if ((req->len + size > sizeof(req->buf)) || (req->seq + 1 >= sizeof(req->what)/sizeof(req->what[0]))) {
+    fprintf(stderr, "error: rtnetlink request too large\n");
+    return NULL;
+  }
+
+  struct nlmsghdr *h = (struct nlmsghdr *)(req->buf + req->len);
+  memset(h, 0, size);
+  h->nlmsg_len = NLMSG_LENGTH(len);
+  h->nlmsg_type = type;
+  h->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+  h->nlmsg_seq = ++req->seq;
+  memcpy(NLMSG_DATA(h), data, len);
+
+  req->what[req->seq] = what;
+  req->len += NLMSG_ALIGN(h->nlmsg_len);
+  return h;
+}
+
+
+// appends attribute to h, which must be the last message of req
+struct rtattr *
+add_attr(struct request *req, struct nlmsghdr *h, int type, const void *data, size_t len) {
+  size_t offset = (char *)h - req->buf;
+  size_t size = NLMSG_ALIGN(h->nlmsg_len) + RTA_SPACE(len);
+
+  if (offset + size > sizeof(req->buf)) {
+    fprintf(stderr, "error: rtnetlink request too large\n");
+    return NULL;
+  }
+
+  struct rtattr *rta = (struct rtattr *)((char *)h + NLMSG_ALIGN(h->nlmsg_len));
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH(len);
+  if (len) {
+    memcpy(RTA_DATA(rta), data, len);
+  }
+
+  h->nlmsg_len = NLMSG_ALIGN(h->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+  req->len = offset + NLMSG_ALIGN(h->nlmsg_len);
+  return rta;
+}
+
+
+void
+end_nest(struct nlmsghdr *h, struct rtattr *nest) {
+  nest->rta_len = (char *)h + h->nlmsg_len - (char *)nest;
+}
+
+
+int
+open_rtnetlink() {
+  int fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    fprintf(stderr, "error: socket, %m\n");
+  }
+
+  return fd;
+}
+
+
+// sends all messages of req in one go, and waits for all the acks
+int
+send_request(int fd, struct request *req) {
+  struct sockaddr_nl addr = {
+    .nl_family = AF_NETLINK,
+  };
+
+  if (sendto(fd, req->buf, req->len, 0, (struct sockaddr *)&addr, sizeof(addr)) != (ssize_t)req->len) {
+    fprintf(stderr, "error: send rtnetlink, %m\n");
+    return -1;
+  }
+
+  unsigned int acked = 0;
+  int result = 0;
+  char buf[8192];
+
+  while (acked < req->seq) {
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "error: recv rtnetlink, %m\n");
+      return -1;
+    }
+
+    for(struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_type != NLMSG_ERROR) {
+        continue;
+      }
+
+      struct nlmsgerr *err = NLMSG_DATA(h);
+      acked++;
+
+      if (err->error != 0) {
+        errno = -err->error;
+        fprintf(stderr, "error: %s, %m\n", ((h->nlmsg_seq > 0) && (h->nlmsg_seq <= req->seq))?req->what[h->nlmsg_seq]:"rtnetlink");
+        result = -1;
+      }
+    }
+  }
+
+  return result;
+}
+
+
+int
+parse_address(const char *s, struct in_addr *addr, unsigned char *prefixlen) {
+  char buf[INET_ADDRSTRLEN + 4] = {0};
+  strncpy(buf, s, sizeof(buf) - 1);
+
+  char *slash = strchr(buf, '/');
+  int prefix = 32;
+
+  if (slash) {
+    *slash = '\0';
+    char *end;
+    prefix = strtol(slash + 1, &end, 10);
+    if ((*end != '\0') || (prefix < 0) || (prefix > 32)) {
+      fprintf(stderr, "error: invalid prefix length '%s'\n", s);
+      return -1;
+    }
+  }
+
+  if (inet_pton(AF_INET, buf, addr) != 1) {
+    fprintf(stderr, "error: invalid address '%s'\n", s);
+    return -1;
+  }
+
+  if (prefixlen) {
+    *prefixlen = prefix;
+  }
+
+  return 0;
+}
+
+
+// same as 'ip netns add', but leaves the calling process in the new
+// network namespace
+int
+add_netns(const char *path) {
+  if ((mkdir(NETNS_RUN_DIR, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH) != 0) && (errno != EEXIST)) {
+    fprintf(stderr, "error: mkdir '%s', %m\n", NETNS_RUN_DIR);
+    return -1;
+  }
+
+  // shared, so that the mount of the namespace propagates to mount
+  // namespaces created before
+  int bound = 0;
+  while (mount("", NETNS_RUN_DIR, "none", MS_SHARED|MS_REC, NULL) != 0) {
+    if ((errno != EINVAL) || bound) {
+      fprintf(stderr, "error: mount --make-shared '%s', %m\n", NETNS_RUN_DIR);
+      return -1;
+    }
+
+    if (mount(NETNS_RUN_DIR, NETNS_RUN_DIR, "none", MS_BIND|MS_REC, NULL) != 0) {
+      fprintf(stderr, "error: mount --bind '%s', %m\n", NETNS_RUN_DIR);
+      return -1;
+    }
+
+    bound = 1;
+  }
+
+  {
+    int fd __attribute__((cleanup(cleanup_fd))) = open(path, O_RDONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0);
+    if (fd < 0) {
+      fprintf(stderr, "error: create '%s', %m\n", path);
+      return -1;
+    }
+  }
+
+  if (unshare(CLONE_NEWNET) != 0) {
+    fprintf(stderr, "error: unshare net namespace, %m\n");
+    unlink(path);
+    return -1;
+  }
+
+  if (mount("/proc/self/ns/net", path, "none", MS_BIND, NULL) != 0) {
+    fprintf(stderr, "error: mount '%s', %m\n", path);
+    unlink(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void
+delete_netns(const char *path) {
+  umount2(path, MNT_DETACH);
+  unlink(path);
+}
+
+
+int
+enter_netns(const char *name) {
+  char path[PATH_MAX] = {0};
+  snprintf(path, PATH_MAX, "%s/%s", NETNS_RUN_DIR, name);
+
+  int fd __attribute__((cleanup(cleanup_fd))) = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", path);
+    return -1;
+  }
+
+  if (setns(fd, CLONE_NEWNET) != 0) {
+    fprintf(stderr, "error: setns '%s', %m\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+// the macvlan is created right into netns_fd, so its name never
+// clashes with others being created in the namespace of its parent,
+// and no lock is needed
+int
+add_macvlan(int netns_fd) {
+  int fd __attribute__((cleanup(cleanup_fd))) = open_rtnetlink();
+  if (fd < 0) {
+    return -1;
+  }
+
+  unsigned int link = if_nametoindex(opt_link);
+  if (link == 0) {
+    fprintf(stderr, "error: link '%s', %m\n", opt_link);
+    return -1;
+  }
+
+  struct request req = {0};
+  struct ifinfomsg ifi = {
+    .ifi_family = AF_UNSPEC,
+  };
+
+  struct nlmsghdr *h = add_message(&req, RTM_NEWLINK, NLM_F_CREATE|NLM_F_EXCL, &ifi, sizeof(ifi), "add macvlan");
+  if (h == NULL) {
+    return -1;
+  }
+
+  uint32_t mode = MACVLAN_MODE_BRIDGE;
+  struct rtattr *info, *data;
+
+  if ((add_attr(&req, h, IFLA_LINK, &link, sizeof(link)) == NULL) ||
+      (add_attr(&req, h, IFLA_IFNAME, opt_ifname, strlen(opt_ifname) + 1) == NULL) ||
+      (add_attr(&req, h, IFLA_NET_NS_FD, &netns_fd, sizeof(netns_fd)) == NULL) ||
+      ((info = add_attr(&req, h, IFLA_LINKINFO, NULL, 0)) == NULL) ||
+      (add_attr(&req, h, IFLA_INFO_KIND, "macvlan", strlen("macvlan")) == NULL) ||
+      ((data = add_attr(&req, h, IFLA_INFO_DATA, NULL, 0)) == NULL) ||
+      (add_attr(&req, h, IFLA_MACVLAN_MODE, &mode, sizeof(mode)) == NULL)) {
+    return -1;
+  }
+
+  end_nest(h, data);
+  end_nest(h, info);
+
+  return send_request(fd, &req);
+}
+
+
+// run inside the new namespace, brings up lo and the macvlan, and
+// assigns address and default route, in a single request
+int
+setup_links() {
+  int fd __attribute__((cleanup(cleanup_fd))) = open_rtnetlink();
+  if (fd < 0) {
+    return -1;
+  }
+
+  unsigned int index = if_nametoindex(opt_ifname);
+  if (index == 0) {
+    fprintf(stderr, "error: link '%s', %m\n", opt_ifname);
+    return -1;
+  }
+
+  struct request req = {0};
+
+  struct ifinfomsg lo = {
+    .ifi_family = AF_UNSPEC,
+    .ifi_index = 1,
+    .ifi_flags = IFF_UP,
+    .ifi_change = IFF_UP,
+  };
+
+  struct ifinfomsg eth = {
+    .ifi_family = AF_UNSPEC,
+    .ifi_index = index,
+    .ifi_flags = IFF_UP,
+    .ifi_change = IFF_UP,
+  };
+
+  if ((add_message(&req, RTM_NEWLINK, 0, &lo, sizeof(lo), "set lo up") == NULL) ||
+      (add_message(&req, RTM_NEWLINK, 0, &eth, sizeof(eth), "set link up") == NULL)) {
+    return -1;
+  }
+
+  if (opt_address) {
+    struct in_addr addr;
+    unsigned char prefixlen;
+    if (parse_address(opt_address, &addr, &prefixlen) != 0) {
+      return -1;
+    }
+
+    struct ifaddrmsg ifa = {
+      .ifa_family = AF_INET,
+      .ifa_prefixlen = prefixlen,
+      .ifa_scope = RT_SCOPE_UNIVERSE,
+      .ifa_index = index,
+    };
+
+    struct nlmsghdr *h = add_message(&req, RTM_NEWADDR, NLM_F_CREATE|NLM_F_EXCL, &ifa, sizeof(ifa), "add address");
+    if ((h == NULL) ||
+        (add_attr(&req, h, IFA_LOCAL, &addr, sizeof(addr)) == NULL) ||
+        (add_attr(&req, h, IFA_ADDRESS, &addr, sizeof(addr)) == NULL)) {
+      return -1;
+    }
+  }
+
+  if (opt_gateway) {
+    struct in_addr gateway;
+    if (parse_address(opt_gateway, &gateway, NULL) != 0) {
+      return -1;
+    }
+
+    struct rtmsg rtm = {
+      .rtm_family = AF_INET,
+      .rtm_table = RT_TABLE_MAIN,
+      .rtm_protocol = RTPROT_BOOT,
+      .rtm_scope = RT_SCOPE_UNIVERSE,
+      .rtm_type = RTN_UNICAST,
+    };
+
+    uint32_t oif = index;
+    struct nlmsghdr *h = add_message(&req, RTM_NEWROUTE, NLM_F_CREATE|NLM_F_EXCL, &rtm, sizeof(rtm), "add default route");
+    if ((h == NULL) ||
+        (add_attr(&req, h, RTA_GATEWAY, &gateway, sizeof(gateway)) == NULL) ||
+        (add_attr(&req, h, RTA_OIF, &oif, sizeof(oif)) == NULL)) {
+      return -1;
+    }
+  }
+
+  return send_request(fd, &req);
+}
+
+
+int
+main(int argc, char *const argv[]) {
+  executable = argv[0];
+
+  int netns_fd __attribute__((cleanup(cleanup_fd))) = -1;
+  int opt, index;
+
+  while((opt = getopt_long(argc, argv, "+n:h", options, &index)) != -1) {
+    switch(opt) {
+    case '?':
+      goto argument;
+
+    case 'h':
+      show_usage();
+      break;
+
+    case 'n':
+      opt_name = optarg;
+      break;
+
+    case OPT_LINK:
+      opt_link = optarg;
+      break;
+
+    case OPT_LINKNETNS:
+      opt_link_netns = optarg;
+      break;
+
+    case OPT_IFNAME:
+      opt_ifname = optarg;
+      break;
+
+    case OPT_ADDRESS:
+      opt_address = optarg;
+      break;
+
+    case OPT_GATEWAY:
+      opt_gateway = optarg;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  if (!opt_name) {
+    fprintf(stderr, "error: missing name\n");
+    goto argument;
+  }
+
+  if (strchr(opt_name, '/') || (strlen(opt_name) >= NAME_MAX)) {
+    fprintf(stderr, "error: invalid name '%s'\n", opt_name);
+    goto argument;
+  }
+
+  char path[PATH_MAX] = {0};
+  snprintf(path, PATH_MAX, "%s/%s", NETNS_RUN_DIR, opt_name);
+
+  if (add_netns(path) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  netns_fd = open(path, O_RDONLY|O_CLOEXEC);
+  if (netns_fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", path);
+    delete_netns(path);
+    return EXIT_FAILURE;
+  }
+
+  if ((enter_netns(opt_link_netns) != 0) ||
+      (add_macvlan(netns_fd) != 0)) {
+    delete_netns(path);
+    return EXIT_FAILURE;
+  }
+
+  if (setns(netns_fd, CLONE_NEWNET) != 0) {
+    fprintf(stderr, "error: setns '%s', %m\n", path);
+    delete_netns(path);
+    return EXIT_FAILURE;
+  }
+
+  if (setup_links() != 0) {
+    delete_netns(path);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+
+argument:
+  fprintf(stderr, "Try '%s --help'\n", executable);
+  return EXIT_FAILURE;
+}
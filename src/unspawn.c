@@ -5,26 +5,93 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sched.h>
+#include <stdint.h>
 #include <errno.h>
 #include <libgen.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <time.h>
 #include <sys/syscall.h>
 #include <sys/signal.h>
 #include <sys/signalfd.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
 #include <linux/limits.h>
+#include <linux/mempolicy.h>
 #include <getopt.h>
 
+#include "registry.h"
+#include "trace.h"
+
 #ifndef CLONE_NEWCGROUP
 #define CLONE_NEWCGROUP 0x02000000
 #endif
 
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
 
 #define OPT_USERNS   0
 #define OPT_NETNS    1
 #define OPT_PIDFILE  2
 #define OPT_NOPID    3
 #define OPT_NOCGROUP 4
+#define OPT_LISTEN   5
+#define OPT_CONNECT  6
+#define OPT_CGROUP   7
+#define OPT_WATCH    8
+#define OPT_EXIT     9
+#define OPT_REGISTRY 10
+#define OPT_CPUS     11
+#define OPT_MEMPOLICY 12
+#define OPT_EXEC_SOCKET 13
+#define OPT_EXEC_CONTEXT 14
+#define OPT_TRACE    15
+#define OPT_LIMIT    16
+
+// cgroup v2 interface files written by --cpu-max and alike, in the
+// order of their options, and the controller each one needs
+static const struct {
+  const char *file;
+  const char *controller;
+} limits[] = {
+  {"cpu.max",     "cpu"},
+  {"cpu.weight",  "cpu"},
+  {"memory.max",  "memory"},
+  {"memory.high", "memory"},
+  {"pids.max",    "pids"},
+};
+
+#define NLIMITS (sizeof(limits)/sizeof(limits[0]))
+
+static const struct {
+  const char *name;
+  int mode;
+} mempolicies[] = {
+  {"bind",       MPOL_BIND},
+  {"interleave", MPOL_INTERLEAVE},
+  {"preferred",  MPOL_PREFERRED},
+};
+
+#define NMEMPOLICIES (sizeof(mempolicies)/sizeof(mempolicies[0]))
+
+#define MAX_NUMNODES 1024
+#define LONG_BITS (8 * sizeof(unsigned long))
 
 static char *executable = NULL;
 static char* opt_name = NULL;
@@ -34,6 +101,19 @@ static int opt_netns = 0;
 static char *opt_netns_name = NULL;
 static char *opt_pidfile = NULL;
 static int opt_flags = 0;
+static char *opt_listen = NULL;
+static char *opt_connect = NULL;
+static char *opt_cgroup = NULL;
+static int opt_watch = 0;
+static char *opt_exit = NULL;
+static char *opt_registry = NULL;
+static char *opt_limits[NLIMITS] = {NULL};
+static char *opt_cpus = NULL;
+static char *opt_mempolicy = NULL;
+static char *opt_exec_socket = NULL;
+static char *opt_exec_context = NULL;
+static char *opt_trace = NULL;
+static int opt_help = 0;
 
 
 static struct option options[] = {
@@ -44,6 +124,22 @@ static struct option options[] = {
   {"pidfile",      required_argument, NULL, OPT_PIDFILE},
   {"no-pid",       no_argument,       NULL, OPT_NOPID},
   {"no-cgroup",    no_argument,       NULL, OPT_NOCGROUP},
+  {"listen",       required_argument, NULL, OPT_LISTEN},
+  {"connect",      required_argument, NULL, OPT_CONNECT},
+  {"cgroup",       required_argument, NULL, OPT_CGROUP},
+  {"watch",        no_argument,       NULL, OPT_WATCH},
+  {"exit-status",  required_argument, NULL, OPT_EXIT},
+  {"registry",     required_argument, NULL, OPT_REGISTRY},
+  {"cpu-max",      required_argument, NULL, OPT_LIMIT + 0},
+  {"cpu-weight",   required_argument, NULL, OPT_LIMIT + 1},
+  {"memory-max",   required_argument, NULL, OPT_LIMIT + 2},
+  {"memory-high",  required_argument, NULL, OPT_LIMIT + 3},
+  {"pids-max",     required_argument, NULL, OPT_LIMIT + 4},
+  {"cpus",         required_argument, NULL, OPT_CPUS},
+  {"mempolicy",    required_argument, NULL, OPT_MEMPOLICY},
+  {"exec-socket",  required_argument, NULL, OPT_EXEC_SOCKET},
+  {"exec-context", required_argument, NULL, OPT_EXEC_CONTEXT},
+  {"trace",        required_argument, NULL, OPT_TRACE},
   {"help",         no_argument,       NULL, 'h'},
 
   {NULL,           no_argument,       NULL, 0}
@@ -59,7 +155,31 @@ show_usage() {
          "      --user                 new USER namespace\n"
          "      --net[=NETNS]          new NET namespace, or use NETNS\n"
          "      --no-pid               do not create new PID namespace\n"
+         "      --cgroup=CGROUP        start process in cgroup v2 directory CGROUP,\n"
+         "                             created if missing, and removed on exit\n"
+         "      --cpu-max=MAX          write MAX to cpu.max of CGROUP\n"
+         "      --cpu-weight=WEIGHT    write WEIGHT to cpu.weight of CGROUP\n"
+         "      --memory-max=MAX       write MAX to memory.max of CGROUP\n"
+         "      --memory-high=HIGH     write HIGH to memory.high of CGROUP\n"
+         "      --pids-max=MAX         write MAX to pids.max of CGROUP\n"
+         "      --cpus=LIST            run process on CPUs in LIST, e.g. 0-3,8\n"
+         "      --mempolicy=MODE:NODES allocate memory of process from NUMA NODES,\n"
+         "                             MODE is bind, interleave or preferred\n"
+         "      --exec-socket=SOCKET   start unexec in namespaces of the process, to\n"
+         "                             run commands requested on SOCKET, as a child\n"
+         "                             of the process\n"
+         "      --exec-context=FILE    passed to unexec as --context\n"
          "      --pidfile=PIDFILE      path to pidfile, default ${XDG_RUNTIME_DIR}/userns/${NAME}.pid\n"
+         "      --listen=SOCKET        run as daemon, spawn processes requested on SOCKET\n"
+         "      --connect=SOCKET       ask daemon listening on SOCKET to spawn the process\n"
+         "      --watch                with --connect, print exit events of processes\n"
+         "                             spawned by daemon, one per line\n"
+         "      --exit-status=FILE     write 'EXITCODE SIGNAL TIMESTAMP' to FILE on exit,\n"
+         "                             TIMESTAMP is in nanoseconds since epoch\n"
+         "      --registry=FILE        register process in FILE under PIDFILE, or\n"
+         "                             NAME without --pidfile, instead of pidfile\n"
+         "      --trace=FILE           append a record to FILE as each phase of\n"
+         "                             starting the process ends, see src/trace.h\n"
          "\n"
          "  -h, --help                 print help message and exit\n"
          );
@@ -146,14 +266,313 @@ unshare_user() {
 }
 
 
+// layout of struct clone_args of clone3, as of Linux 5.7, kernel
+// headers in the chroot may not have it yet
+struct clone3_args {
+  uint64_t flags;
+  uint64_t pidfd;
+  uint64_t child_tid;
+  uint64_t parent_tid;
+  uint64_t exit_signal;
+  uint64_t stack;
+  uint64_t stack_size;
+  uint64_t tls;
+  uint64_t set_tid;
+  uint64_t set_tid_size;
+  uint64_t cgroup;
+};
+
+#define CLONE3_ARGS_SIZE_VER0 64
+
+
+// clone3 with CLONE_PIDFD, and CLONE_INTO_CGROUP if cgroup_fd is
+// given, falls back to clone when the kernel does not support it, in
+// which case *pidfd is -1 and *cgroup_fd is left for the child to join.
 pid_t
-_fork(int flags) {
+_fork(int flags, int *pidfd, int *cgroup_fd) {
+  struct clone3_args args = {
+    .flags = flags | CLONE_PIDFD,
+    .pidfd = (uint64_t)(uintptr_t)pidfd,
+    .exit_signal = SIGCHLD,
+  };
+
+  size_t size = CLONE3_ARGS_SIZE_VER0;
+
+  if (*cgroup_fd >= 0) {
+    args.flags |= CLONE_INTO_CGROUP;
+    args.cgroup = *cgroup_fd;
+    size = sizeof(args);
+  }
+
+  pid_t pid = syscall(SYS_clone3, &args, size);
+  if (pid >= 0) {
+    if (pid == 0) {
+      *cgroup_fd = -1;
+    }
+    return pid;
+  }
+
+  if ((errno != ENOSYS) && (errno != E2BIG) && (errno != EINVAL)) {
+    return pid;
+  }
+
+  *pidfd = -1;
   return syscall(SYS_clone, (flags | SIGCHLD), NULL, NULL, NULL);
 }
 
 
+// mkdir -p, enabling controllers in the parent of each directory
+// created, so that they are available in the new cgroup
+int
+make_cgroup(const char *path, const char *controllers) {
+  char parent[PATH_MAX] = {0};
+  strncpy(parent, path, PATH_MAX-1);
+  dirname(parent);
+
+  struct stat buf = {0};
+  if (stat(parent, &buf) != 0) {
+    if (errno != ENOENT) {
+      fprintf(stderr, "error: stat '%s', %m\n", parent);
+      return -1;
+    }
+
+    if (make_cgroup(parent, controllers) != 0) {
+      return -1;
+    }
+  }
+
+  if (controllers[0] && (write_string(controllers, "%s/cgroup.subtree_control", parent) != 0)) {
+    return -1;
+  }
+
+  if ((mkdir(path, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH) != 0) && (errno != EEXIST)) {
+    fprintf(stderr, "error: mkdir '%s', %m\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+// creates --cgroup if missing, and writes the limits before the
+// process is cloned into it, returns 1 if the cgroup is created
+int
+prepare_cgroup(const char *path) {
+  char controllers[64] = {0};
+
+  for(size_t i=0; i<NLIMITS; i++) {
+    if (opt_limits[i] && !strstr(controllers, limits[i].controller)) {
+      size_t len = strlen(controllers);
+      snprintf(controllers + len, sizeof(controllers) - len, "%s+%s", len?" ":"", limits[i].controller);
+    }
+  }
+
+  int created = 0;
+  struct stat buf = {0};
+
+  if (stat(path, &buf) != 0) {
+    if (errno != ENOENT) {
+      fprintf(stderr, "error: stat '%s', %m\n", path);
+      return -1;
+    }
+
+    if (make_cgroup(path, controllers) != 0) {
+      return -1;
+    }
+
+    created = 1;
+  }
+
+  for(size_t i=0; i<NLIMITS; i++) {
+    if (opt_limits[i] && (write_string(opt_limits[i], "%s/%s", path, limits[i].file) != 0)) {
+      if (created) {
+        rmdir(path);
+      }
+      return -1;
+    }
+  }
+
+  return created;
+}
+
+
+int
+open_cgroup(const char *path) {
+  int fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", path);
+  }
+
+  return fd;
+}
+
+
+// parses LIST like 0-3,8 into mask of nbits bits
+int
+parse_list(const char *list, unsigned long *mask, size_t nbits) {
+  const char *p = list;
+
+  for(;;) {
+    char *end = NULL;
+    if ((*p < '0') || (*p > '9')) {
+      return -1;
+    }
+
+    unsigned long first = strtoul(p, &end, 10);
+    unsigned long last = first;
+
+    if (*end == '-') {
+      p = end + 1;
+      if ((*p < '0') || (*p > '9')) {
+        return -1;
+      }
+      last = strtoul(p, &end, 10);
+    }
+
+    if ((first > last) || (last >= nbits)) {
+      return -1;
+    }
+
+    for(unsigned long i=first; i<=last; i++) {
+      mask[i / LONG_BITS] |= 1UL << (i % LONG_BITS);
+    }
+
+    if (*end == '\0') {
+      return 0;
+    }
+
+    if (*end != ',') {
+      return -1;
+    }
+
+    p = end + 1;
+  }
+}
+
+
+// where the process runs and allocates memory, as given by --cpus
+// and --mempolicy, parsed before fork so that errors are reported
+// to the caller
+struct placement {
+  int has_cpus;
+  cpu_set_t cpus;
+  int mode;
+  unsigned long nodes[MAX_NUMNODES / LONG_BITS];
+};
+
+
+int
+parse_placement(struct placement *placement) {
+  memset(placement, 0, sizeof(struct placement));
+  placement->mode = -1;
+
+  if (opt_cpus) {
+    unsigned long mask[CPU_SETSIZE / LONG_BITS] = {0};
+    if (parse_list(opt_cpus, mask, CPU_SETSIZE) != 0) {
+      fprintf(stderr, "error: invalid cpu list '%s'\n", opt_cpus);
+      return -1;
+    }
+
+    placement->has_cpus = 1;
+    CPU_ZERO(&placement->cpus);
+    for(size_t i=0; i<CPU_SETSIZE; i++) {
+      if (mask[i / LONG_BITS] & (1UL << (i % LONG_BITS))) {
+        CPU_SET(i, &placement->cpus);
+      }
+    }
+  }
+
+  if (opt_mempolicy) {
+    const char *nodes = strchr(opt_mempolicy, ':');
+    size_t len = nodes?(size_t)(nodes - opt_mempolicy):0;
+
+    for(size_t i=0; i<NMEMPOLICIES; i++) {
+      if ((strlen(mempolicies[i].name) == len) && (strncmp(mempolicies[i].name, opt_mempolicy, len) == 0)) {
+        placement->mode = mempolicies[i].mode;
+        break;
+      }
+    }
+
+    if ((placement->mode < 0) || (parse_list(nodes + 1, placement->nodes, MAX_NUMNODES) != 0)) {
+      fprintf(stderr, "error: invalid memory policy '%s'\n", opt_mempolicy);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+int
+apply_placement(const struct placement *placement) {
+  if (placement->has_cpus && (sched_setaffinity(0, sizeof(cpu_set_t), &placement->cpus) != 0)) {
+    fprintf(stderr, "error: set cpu affinity, %m\n");
+    return -1;
+  }
+
+  // the kernel reads one bit less than maxnode
+  if ((placement->mode >= 0) && (syscall(SYS_set_mempolicy, placement->mode, placement->nodes, MAX_NUMNODES + 1) != 0)) {
+    fprintf(stderr, "error: set memory policy, %m\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+// forks unexec, which is installed next to unspawn, in the child
+// right before exec, so that it shares everything but the pid with
+// the process, and is killed when the process exits.
+//
+// unexec is thus a child of the process itself, a process which
+// waits for any child, e.g. with waitpid(-1), or counts its children,
+// sees it too. only processes known not to, should be given
+// --exec-socket.
+int
+start_exec_helper() {
+  char path[PATH_MAX] = {0};
+  ssize_t len = readlink("/proc/self/exe", path, PATH_MAX - 1);
+  if (len < 0) {
+    fprintf(stderr, "error: readlink '/proc/self/exe', %m\n");
+    return -1;
+  }
+
+  char *slash = strrchr(path, '/');
+  if ((slash == NULL) || ((size_t)(slash - path) + sizeof("/unexec") > PATH_MAX)) {
+    fprintf(stderr, "error: invalid path '%s'\n", path);
+    return -1;
+  }
+  strcpy(slash, "/unexec");
+
+  char listen[PATH_MAX + 16] = {0};
+  snprintf(listen, sizeof(listen), "--listen=%s", opt_exec_socket);
+  char context[PATH_MAX + 16] = {0};
+  snprintf(context, sizeof(context), "--context=%s", opt_exec_context?opt_exec_context:"");
+  char *const argv[] = {"unexec", listen, opt_exec_context?context:NULL, NULL};
+
+  pid_t parent = getpid();
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "error: fork exec helper, %m\n");
+    return -1;
+  }
+
+  if (pid) {
+    return 0;
+  }
+
+  if ((prctl(PR_SET_PDEATHSIG, SIGKILL) != 0) || (getppid() != parent)) {
+    exit(EXIT_FAILURE);
+  }
+
+  execv(path, argv);
+  fprintf(stderr, "error: exec '%s', %m\n", path);
+  exit(EXIT_FAILURE);
+}
+
+
 pid_t
-spawn_process(char *const argv[], const sigset_t *oldset) {
+spawn_process(char *const argv[], const sigset_t *oldset, int netns_fd, const int stdio[3], int *pidfd) {
   int flags = CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWPID | CLONE_NEWCGROUP;
 
   if (opt_netns && (!opt_netns_name)) {
@@ -162,7 +581,20 @@ spawn_process(char *const argv[], const sigset_t *oldset) {
 
   flags ^= opt_flags;
 
-  pid_t pid = _fork(flags);
+  struct placement placement;
+  if (parse_placement(&placement) != 0) {
+    return -1;
+  }
+
+  int cgroup_fd __attribute__((cleanup(cleanup_fd))) = -1;
+  if (opt_cgroup) {
+    cgroup_fd = open_cgroup(opt_cgroup);
+    if (cgroup_fd < 0) {
+      return -1;
+    }
+  }
+
+  pid_t pid = _fork(flags, pidfd, &cgroup_fd);
 
   if (pid < 0) {
     fprintf(stderr, "error: fork process, %m\n");
@@ -170,6 +602,7 @@ spawn_process(char *const argv[], const sigset_t *oldset) {
   }
 
   if (pid) {
+    trace(TRACE_CLONE, pid);
     return pid;
   }
 
@@ -178,11 +611,39 @@ spawn_process(char *const argv[], const sigset_t *oldset) {
     exit(EXIT_FAILURE);
   }
 
+  if ((cgroup_fd >= 0) && (write_string("0", "%s/cgroup.procs", opt_cgroup) != 0)) {
+    exit(EXIT_FAILURE);
+  }
+
   if (sigprocmask(SIG_SETMASK, oldset, NULL) != 0) {
     fprintf(stderr, "error: set signal mask, %m\n");
     exit(EXIT_FAILURE);
   }
 
+  trace(TRACE_CHILD, 0);
+
+  if (netns_fd >= 0) {
+    if (setns(netns_fd, CLONE_NEWNET) != 0) {
+      fprintf(stderr, "error: set netns, %m\n");
+      exit(EXIT_FAILURE);
+    }
+    trace(TRACE_SETNS, 0);
+  }
+
+  if (stdio) {
+    for(int i=0; i<3; i++) {
+      if (dup2(stdio[i], i) < 0) {
+        fprintf(stderr, "error: dup stdio, %m\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if (setsid() < 0) {
+      fprintf(stderr, "error: setsid, %m\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
   if (setenv("USERNS_NAME", opt_name, 1) != 0) {
     fprintf(stderr, "error: set environment USERNS_NAME, %m\n");
     exit(EXIT_FAILURE);
@@ -203,6 +664,24 @@ spawn_process(char *const argv[], const sigset_t *oldset) {
     exit(EXIT_FAILURE);
   }
 
+  trace(TRACE_HOSTNAME, 0);
+
+  if (apply_placement(&placement) != 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (opt_cpus || opt_mempolicy) {
+    trace(TRACE_PLACEMENT, 0);
+  }
+
+  if (opt_exec_socket) {
+    if (start_exec_helper() != 0) {
+      exit(EXIT_FAILURE);
+    }
+    trace(TRACE_EXEC_HELPER, 0);
+  }
+
+  trace(TRACE_EXEC, 0);
   execvp(argv[0], argv);
   fprintf(stderr, "error: exec, %m\n");
   exit(EXIT_FAILURE);
@@ -250,7 +729,7 @@ write_pid(int dirfd, const char *name, pid_t pid) {
       return -1;
     }
 
-    fd2 = dup(fd);
+    fd2 = fcntl(fd, F_DUPFD_CLOEXEC, 0);
     if (fd2 < 0) {
       fprintf(stderr, "error: dup pidfile, %m\n");
       return -1;
@@ -295,25 +774,25 @@ write_pid(int dirfd, const char *name, pid_t pid) {
         return -1;
       }
 
-      off_t len = lseek(fd3, 0, SEEK_END);
-      if (len < 0) {
+      off_t size = lseek(fd3, 0, SEEK_END);
+      if (size < 0) {
         fprintf(stderr, "error: lseek pidfile, %m\n");
         return -1;
       }
 
-      struct flock lock = {
+      struct flock other = {
         .l_type = F_WRLCK,
         .l_whence = SEEK_SET,
         .l_start = 0,
-        .l_len = len,
+        .l_len = size,
       };
 
-      if (fcntl(fd3, F_GETLK, &lock) != 0) {
+      if (fcntl(fd3, F_GETLK, &other) != 0) {
         fprintf(stderr, "error: lock pidfile, %m\n");
         return -1;
       }
 
-      if (lock.l_type != F_UNLCK) {
+      if (other.l_type != F_UNLCK) {
         fprintf(stderr, "error: pidfile locked\n");
         return -1;
       }
@@ -329,9 +808,9 @@ write_pid(int dirfd, const char *name, pid_t pid) {
   }
 }
 
-pid_t
-spawn_and_wait(const char *path, const char *name, char *const argv[]) {
-  int dirfd __attribute__((cleanup(cleanup_fd))) = open(path, O_PATH|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+int
+open_dir(const char *path) {
+  int dirfd = open(path, O_PATH|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
 
   if ((dirfd < 0) && (errno == ENOENT)) {
     if ((mkdir(path, S_IRWXU) != 0) && (errno != EEXIST)) {
@@ -344,16 +823,95 @@ spawn_and_wait(const char *path, const char *name, char *const argv[]) {
 
   if (dirfd < 0) {
     fprintf(stderr, "error: open '%s', %m\n", path);
-    return -1;
   }
 
-  if (opt_netns_name) {
-    char netns_fd_path[PATH_MAX] = {0};
-    snprintf(netns_fd_path, PATH_MAX, "/var/run/netns/%s", opt_netns_name);
-    int netns_fd __attribute__((cleanup(cleanup_fd))) = open(netns_fd_path, O_RDONLY);
+  return dirfd;
+}
+
+
+int
+open_netns(const char *name) {
+  char path[PATH_MAX] = {0};
+  snprintf(path, PATH_MAX, "/var/run/netns/%s", name);
+
+  int fd = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", path);
+  }
+
+  return fd;
+}
+
+
+long long
+realtime() {
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+// inode numbers of namespaces of the process for the registry, the
+// child joins netns_fd only after it is started
+void
+read_ns(pid_t pid, int netns_fd, uint64_t ns[REGISTRY_NS]) {
+  static char const* filename[REGISTRY_NS] = {
+      "user",
+      "uts",
+      "ipc",
+      "net",
+      "cgroup",
+      "pid",
+      "mnt",
+  };
+
+  for(int i=0; i<REGISTRY_NS; i++) {
+    struct stat buf = {0};
+    char path[PATH_MAX] = {0};
+    snprintf(path, PATH_MAX, "/proc/%d/ns/%s", pid, filename[i]);
+
+    if ((i == 3) && (netns_fd >= 0)) {
+      ns[i] = (fstat(netns_fd, &buf) == 0)?buf.st_ino:0;
+    } else {
+      ns[i] = (stat(path, &buf) == 0)?buf.st_ino:0;
+    }
+  }
+}
+
+
+// registers the process in --registry, or writes its pidfile, returns
+// the slot, or the locked pidfile
+int
+register_pid(struct registry *reg, int dirfd, const char *name, pid_t pid, int netns_fd) {
+  if (!opt_registry) {
+    return write_pid(dirfd, name, pid);
+  }
 
+  uint64_t ns[REGISTRY_NS] = {0};
+  read_ns(pid, netns_fd, ns);
+  return registry_add(reg, opt_pidfile?opt_pidfile:opt_name, pid, realtime(), ns);
+}
+
+
+pid_t
+spawn_and_wait(const char *path, const char *name, char *const argv[]) {
+  struct registry reg __attribute__((cleanup(registry_close))) = {.fd = -1};
+  int dirfd __attribute__((cleanup(cleanup_fd))) = -1;
+
+  if (opt_registry) {
+    if (registry_open(&reg, opt_registry, 1) != 0) {
+      return -1;
+    }
+  } else {
+    dirfd = open_dir(path);
+    if (dirfd < 0) {
+      return -1;
+    }
+  }
+
+  if (opt_netns_name) {
+    int netns_fd __attribute__((cleanup(cleanup_fd))) = open_netns(opt_netns_name);
     if (netns_fd < 0) {
-      fprintf(stderr, "error: open '%s', %m\n", netns_fd_path);
       return -1;
     }
 
@@ -361,12 +919,14 @@ spawn_and_wait(const char *path, const char *name, char *const argv[]) {
       fprintf(stderr, "error: set netns, %m\n");
       return -1;
     }
+    trace(TRACE_NETNS, 0);
   }
 
   if (opt_userns) {
     if (unshare_user() != 0) {
       return -1;
     }
+    trace(TRACE_USERNS, 0);
   }
 
   sigset_t set, oldset;
@@ -385,7 +945,8 @@ spawn_and_wait(const char *path, const char *name, char *const argv[]) {
       return -1;
     }
 
-    pid_t pid = spawn_process(argv, &oldset);
+    int pidfd __attribute__((cleanup(cleanup_fd))) = -1;
+    pid_t pid = spawn_process(argv, &oldset, -1, NULL, &pidfd);
     if (pid < 0) {
       return -1;
     }
@@ -393,45 +954,79 @@ spawn_and_wait(const char *path, const char *name, char *const argv[]) {
     close(STDIN_FILENO);
     close(STDOUT_FILENO);
 
-    {
-      int fd __attribute__((cleanup(cleanup_fd))) = write_pid(dirfd, name, pid);
-      if (fd < 0) {
-        kill(pid, SIGKILL);
-        return -1;
-      }
+    int fd = register_pid(&reg, dirfd, name, pid, -1);
+    if (fd < 0) {
+      kill(pid, SIGKILL);
+      return -1;
+    }
 
-      if (kill(pid, SIGCONT) != 0) {
-        fprintf(stderr, "error: continue child process, %m\n");
-        kill(pid, SIGKILL);
-        return -1;
-      }
+    trace(TRACE_REGISTER, pid);
+
+    int result = pid;
+
+    if (kill(pid, SIGCONT) != 0) {
+      fprintf(stderr, "error: continue child process, %m\n");
+      kill(pid, SIGKILL);
+      result = -1;
+    } else {
+      trace(TRACE_CONTINUE, pid);
+      trace_close();
 
       struct signalfd_siginfo fdsi = {0};
       if (read(sfd, &fdsi, sizeof(struct signalfd_siginfo)) != sizeof(struct signalfd_siginfo)) {
         fprintf(stderr, "error: read signalfd %m\n");
         kill(pid, SIGKILL);
-        return -1;
+        result = -1;
       }
     }
 
-    unlinkat(dirfd, name, 0);
-    return pid;
+    // entry must be off the robust list before the registry is unmapped
+    if (opt_registry) {
+      registry_remove(&reg, fd);
+    } else {
+      unlinkat(dirfd, name, 0);
+      close(fd);
+    }
+
+    return result;
   }
 }
 
+
 int
-main(int argc, char *const argv[]) {
-  executable = argv[0];
+parse_options(int argc, char *const argv[]) {
+  opt_name = NULL;
+  opt_domain = NULL;
+  opt_userns = 0;
+  opt_netns = 0;
+  opt_netns_name = NULL;
+  opt_pidfile = NULL;
+  opt_flags = 0;
+  opt_listen = NULL;
+  opt_connect = NULL;
+  opt_cgroup = NULL;
+  opt_watch = 0;
+  opt_exit = NULL;
+  opt_registry = NULL;
+  memset(opt_limits, 0, sizeof(opt_limits));
+  opt_cpus = NULL;
+  opt_mempolicy = NULL;
+  opt_exec_socket = NULL;
+  opt_exec_context = NULL;
+  opt_trace = NULL;
+  opt_help = 0;
+
+  optind = 0;
 
   int opt, index;
 
   while((opt = getopt_long(argc, argv, "+n:d:h", options, &index)) != -1) {
     switch(opt) {
     case '?':
-      goto argument;
+      return -1;
 
     case 'h':
-      show_usage();
+      opt_help = 1;
       break;
 
     case 'n':
@@ -463,22 +1058,64 @@ main(int argc, char *const argv[]) {
       opt_flags |= CLONE_NEWCGROUP;
       break;
 
+    case OPT_LISTEN:
+      opt_listen = optarg;
+      break;
+
+    case OPT_CONNECT:
+      opt_connect = optarg;
+      break;
+
+    case OPT_CGROUP:
+      opt_cgroup = optarg;
+      break;
+
+    case OPT_WATCH:
+      opt_watch = 1;
+      break;
+
+    case OPT_EXIT:
+      opt_exit = optarg;
+      break;
+
+    case OPT_REGISTRY:
+      opt_registry = optarg;
+      break;
+
+    case OPT_CPUS:
+      opt_cpus = optarg;
+      break;
+
+    case OPT_MEMPOLICY:
+      opt_mempolicy = optarg;
+      break;
+
+    case OPT_EXEC_SOCKET:
+      opt_exec_socket = optarg;
+      break;
+
+    case OPT_TRACE:
+      opt_trace = optarg;
+      break;
+
+    case OPT_EXEC_CONTEXT:
+      opt_exec_context = optarg;
+      break;
+
     default:
+      if ((opt >= OPT_LIMIT) && (opt < (int)(OPT_LIMIT + NLIMITS))) {
+        opt_limits[opt - OPT_LIMIT] = optarg;
+      }
       break;
     }
   }
 
-  if (!opt_name) {
-    fprintf(stderr, "error: missing name\n");
-    goto argument;
-  }
+  return 0;
+}
 
-  opt_domain = (opt_domain)?opt_domain:getenv("USERNS_DOMAIN");
-  opt_domain = (opt_domain)?opt_domain:"localdomain";
-
-  char path[PATH_MAX] = {0};
-  char name[PATH_MAX] = {0};
 
+int
+pidfile_path(char *path, char *name) {
   if (opt_pidfile) {
     char tmp[PATH_MAX] = {0};
     strncpy(tmp, opt_pidfile, PATH_MAX-1);
@@ -489,22 +1126,794 @@ main(int argc, char *const argv[]) {
     char *rundir = getenv("XDG_RUNTIME_DIR");
     if (!rundir) {
       fprintf(stderr, "error: environment XDG_RUNTIME_DIR not set\n");
-      return EXIT_FAILURE;
+      return -1;
     }
     snprintf(path, PATH_MAX, "%s/userns", rundir);
     strncpy(name, opt_name, PATH_MAX-1);
   }
 
+  return 0;
+}
+
+
+// replaced by rename, so that it is either absent or complete
+int
+write_exit_status(const char *path, int code, int sig, long long timestamp) {
+  char tmp[PATH_MAX] = {0};
+  snprintf(tmp, PATH_MAX, "%s.tmp", path);
+
+  int fd __attribute__((cleanup(cleanup_fd))) = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+  if (fd < 0) {
+    fprintf(stderr, "error: open '%s', %m\n", tmp);
+    return -1;
+  }
+
+  if (dprintf(fd, "%d %d %lld\n", code, sig, timestamp) < 0) {
+    fprintf(stderr, "error: write '%s', %m\n", tmp);
+    return -1;
+  }
+
+  if (rename(tmp, path) != 0) {
+    fprintf(stderr, "error: rename '%s', %m\n", tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+// children spawned by the daemon, each one keeps its pidfile locked,
+// or its registry entry owned, until the child is reaped
+struct child {
+  pid_t pid;
+  int pidfd;
+  int dirfd;
+  // locked pidfile, or slot in registry
+  int fd;
+  struct registry *registry;
+  char name[NAME_MAX+1];
+  char *pidfile;
+  char *exit_status;
+  // created by the daemon, removed when the child is reaped
+  char *cgroup;
+};
+
+static struct child *children = NULL;
+static size_t nchildren = 0;
+static size_t maxchildren = 0;
+
+// connections asked for exit events with --watch
+static int *watchers = NULL;
+static size_t nwatchers = 0;
+static size_t maxwatchers = 0;
+
+// registries of requests, mapped until the daemon exits
+#define MAX_REGISTRIES 8
+
+static struct registry registries[MAX_REGISTRIES];
+static char *registry_paths[MAX_REGISTRIES];
+static size_t nregistries = 0;
+
+static int epoll_fd = -1;
+
+#define EVENT_CLIENT 0
+#define EVENT_CHILD  1
+
+
+int
+epoll_add(int efd, int fd, uint32_t kind) {
+  struct epoll_event event = {
+    .events = EPOLLIN,
+    .data.u64 = ((uint64_t)kind << 32) | (uint32_t)fd,
+  };
+
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &event) != 0) {
+    fprintf(stderr, "error: epoll_ctl, %m\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+struct registry *
+open_registry(const char *path) {
+  for(size_t i=0; i<nregistries; i++) {
+    if (strcmp(registry_paths[i], path) == 0) {
+      return &registries[i];
+    }
+  }
+
+  if (nregistries == MAX_REGISTRIES) {
+    fprintf(stderr, "error: too many registries\n");
+    return NULL;
+  }
+
+  if (registry_open(&registries[nregistries], path, 1) != 0) {
+    return NULL;
+  }
+
+  registry_paths[nregistries] = strdup(path);
+  return &registries[nregistries++];
+}
+
+
+int
+add_child(pid_t pid, int pidfd, int dirfd, int fd, struct registry *registry, const char *name, int cgroup_created) {
+  if (nchildren == maxchildren) {
+    size_t size = maxchildren?(maxchildren*2):64;
+    struct child *p = realloc(children, size * sizeof(struct child));
+    if (p == NULL) {
+      fprintf(stderr, "error: realloc children, %m\n");
+      return -1;
+    }
+    children = p;
+    maxchildren = size;
+  }
+
+  // without pidfd, the child is reaped on SIGCHLD
+  if ((pidfd >= 0) && (epoll_add(epoll_fd, pidfd, EVENT_CHILD) != 0)) {
+    return -1;
+  }
+
+  struct child *c = &children[nchildren++];
+  c->pid = pid;
+  c->pidfd = pidfd;
+  c->dirfd = dirfd;
+  c->fd = fd;
+  c->registry = registry;
+  strncpy(c->name, name, NAME_MAX);
+  c->name[NAME_MAX] = '\0';
+  c->pidfile = strdup(opt_pidfile?opt_pidfile:name);
+  c->exit_status = opt_exit?strdup(opt_exit):NULL;
+  c->cgroup = cgroup_created?strdup(opt_cgroup):NULL;
+  return 0;
+}
+
+
+int
+add_watcher(int fd) {
+  if (nwatchers == maxwatchers) {
+    size_t size = maxwatchers?(maxwatchers*2):4;
+    int *p = realloc(watchers, size * sizeof(int));
+    if (p == NULL) {
+      fprintf(stderr, "error: realloc watchers, %m\n");
+      return -1;
+    }
+    watchers = p;
+    maxwatchers = size;
+  }
+
+  watchers[nwatchers++] = fd;
+  return 0;
+}
+
+
+void
+remove_watcher(int fd) {
+  for(size_t i=0; i<nwatchers; i++) {
+    if (watchers[i] == fd) {
+      watchers[i] = watchers[--nwatchers];
+      return;
+    }
+  }
+}
+
+
+// event is 'EXITCODE SIGNAL TIMESTAMP PIDFILE', a watcher not keeping
+// up is dropped and has to check all processes again
+void
+notify_watchers(const char *pidfile, int code, int sig, long long timestamp) {
+  char event[PATH_MAX + 64] = {0};
+  int len = snprintf(event, sizeof(event), "%d %d %lld %s", code, sig, timestamp, pidfile);
+
+  for(size_t i=0; i<nwatchers; i++) {
+    if (send(watchers[i], event, len, MSG_NOSIGNAL|MSG_DONTWAIT) != len) {
+      shutdown(watchers[i], SHUT_RDWR);
+    }
+  }
+}
+
+
+// child has exited but is not reaped yet, so that its pid is not
+// reused until its pidfile is unlocked, or its registry entry removed
+void
+child_exited(size_t i, const siginfo_t *info) {
+  struct child *c = &children[i];
+
+  long long timestamp = realtime();
+  int code = info->si_status;
+  int sig = 0;
+
+  if (info->si_code != CLD_EXITED) {
+    sig = info->si_status;
+    code = sig + 128;
+  }
+
+  if (c->exit_status) {
+    write_exit_status(c->exit_status, code, sig, timestamp);
+  }
+
+  notify_watchers(c->pidfile, code, sig, timestamp);
+
+  if (c->registry) {
+    registry_remove(c->registry, c->fd);
+  } else {
+    unlinkat(c->dirfd, c->name, 0);
+    close(c->fd);
+    close(c->dirfd);
+  }
+
+  siginfo_t reaped = {0};
+  if (waitid(P_PID, c->pid, &reaped, WEXITED|WNOHANG) != 0) {
+    fprintf(stderr, "error: reap %d, %m\n", c->pid);
+  }
+
+  if (c->pidfd >= 0) {
+    close(c->pidfd);
+  }
+  if (c->cgroup) {
+    rmdir(c->cgroup);
+  }
+
+  free(c->pidfile);
+  free(c->exit_status);
+  free(c->cgroup);
+  children[i] = children[--nchildren];
+}
+
+
+void
+reap_child(int pidfd) {
+  for(size_t i=0; i<nchildren; i++) {
+    if (children[i].pidfd != pidfd) {
+      continue;
+    }
+
+    siginfo_t info = {0};
+    if (waitid(P_PIDFD, pidfd, &info, WEXITED|WNOHANG|WNOWAIT) != 0) {
+      fprintf(stderr, "error: waitid, %m\n");
+      return;
+    }
+
+    if (info.si_pid != 0) {
+      child_exited(i, &info);
+    }
+
+    return;
+  }
+}
+
+
+void
+reap_children() {
+  for(size_t i=nchildren; i>0; i--) {
+    if (children[i-1].pidfd >= 0) {
+      continue;
+    }
+
+    siginfo_t info = {0};
+    if (waitid(P_PID, children[i-1].pid, &info, WEXITED|WNOHANG|WNOWAIT) != 0) {
+      continue;
+    }
+
+    if (info.si_pid != 0) {
+      child_exited(i-1, &info);
+    }
+  }
+}
+
+
+// kills a child not added to children, and reaps it right away, so
+// that no zombie is left behind, nor its cgroup
+void
+kill_child(pid_t pid, int cgroup_created) {
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+
+  if (cgroup_created) {
+    rmdir(opt_cgroup);
+  }
+}
+
+
+pid_t
+spawn_request(int argc, char *const argv[], const int stdio[3], const sigset_t *oldset) {
+  if (opt_help || opt_userns || opt_listen || opt_connect) {
+    fprintf(stderr, "error: option not allowed in request\n");
+    return -1;
+  }
+
+  if (!opt_name) {
+    fprintf(stderr, "error: missing name\n");
+    return -1;
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "error: missing command\n");
+    return -1;
+  }
+
+  opt_domain = (opt_domain)?opt_domain:getenv("USERNS_DOMAIN");
+  opt_domain = (opt_domain)?opt_domain:"localdomain";
+
+  char path[PATH_MAX] = {0};
+  char name[PATH_MAX] = {0};
+
+  if (pidfile_path(path, name) != 0) {
+    return -1;
+  }
+
+  if (opt_trace && (trace_open(opt_trace, opt_pidfile?opt_pidfile:opt_name) != 0)) {
+    return -1;
+  }
+
+  trace(TRACE_START, 0);
+
+  struct registry *registry = NULL;
+  int dirfd __attribute__((cleanup(cleanup_fd))) = -1;
+
+  if (opt_registry) {
+    registry = open_registry(opt_registry);
+    if (registry == NULL) {
+      return -1;
+    }
+  } else {
+    dirfd = open_dir(path);
+    if (dirfd < 0) {
+      return -1;
+    }
+  }
+
+  int netns_fd __attribute__((cleanup(cleanup_fd))) = -1;
+  if (opt_netns_name) {
+    netns_fd = open_netns(opt_netns_name);
+    if (netns_fd < 0) {
+      return -1;
+    }
+    trace(TRACE_NETNS, 0);
+  }
+
+  int cgroup_created = opt_cgroup?prepare_cgroup(opt_cgroup):0;
+  if (cgroup_created < 0) {
+    return -1;
+  }
+
+  if (opt_cgroup) {
+    trace(TRACE_CGROUP, 0);
+  }
+
+  int pidfd __attribute__((cleanup(cleanup_fd))) = -1;
+  pid_t pid = spawn_process(argv + optind, oldset, netns_fd, stdio, &pidfd);
+  if (pid < 0) {
+    if (cgroup_created) {
+      rmdir(opt_cgroup);
+    }
+    return -1;
+  }
+
+  int fd = register_pid(registry, dirfd, name, pid, netns_fd);
+  if (fd < 0) {
+    kill_child(pid, cgroup_created);
+    return -1;
+  }
+
+  trace(TRACE_REGISTER, pid);
+
+  if (add_child(pid, pidfd, dirfd, fd, registry, name, cgroup_created) != 0) {
+    if (registry) {
+      registry_remove(registry, fd);
+    } else {
+      unlinkat(dirfd, name, 0);
+      close(fd);
+    }
+    kill_child(pid, cgroup_created);
+    return -1;
+  }
+
+  dirfd = -1;
+  pidfd = -1;
+
+  if (kill(pid, SIGCONT) != 0) {
+    fprintf(stderr, "error: continue child process, %m\n");
+    kill(pid, SIGKILL);
+    return -1;
+  }
+
+  trace(TRACE_CONTINUE, pid);
+  return pid;
+}
+
+
+// a request is a single SOCK_SEQPACKET message, its payload are the
+// arguments of unspawn, each terminated by NUL, optionally followed
+// by stdin, stdout and stderr of the process passed as SCM_RIGHTS.
+// the reply is the pid of the process in decimal, or -1 on failure.
+// a request of only --watch turns the connection into a watcher.
+int
+handle_request(int fd, const sigset_t *oldset) {
+  char buf[65536];
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * 3)];
+  } control;
+
+  struct iovec iov = {
+    .iov_base = buf,
+    .iov_len = sizeof(buf) - 1,
+  };
+
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+
+  ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (len < 0) {
+    fprintf(stderr, "error: recvmsg, %m\n");
+    return -1;
+  }
+
+  if (len == 0) {
+    return 0;
+  }
+
+  int fds[3] = {-1, -1, -1};
+  int nfds = 0;
+
+  for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+      continue;
+    }
+
+    nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * ((nfds < 3)?nfds:3));
+  }
+
+  pid_t pid = -1;
+
+  if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
+    fprintf(stderr, "error: request truncated\n");
+  } else if ((nfds != 0) && (nfds != 3)) {
+    fprintf(stderr, "error: expect 3 file descriptors, got %d\n", nfds);
+  } else if (buf[len-1] != '\0') {
+    fprintf(stderr, "error: invalid request\n");
+  } else {
+    buf[len] = '\0';
+
+    int argc = 1;
+    for(ssize_t i=0; i<len; i++) {
+      argc += (buf[i] == '\0');
+    }
+
+    char *argv[argc+1];
+    argv[0] = executable;
+    argc = 1;
+    for(ssize_t i=0; i<len; i += strlen(buf+i)+1) {
+      argv[argc++] = buf+i;
+    }
+    argv[argc] = NULL;
+
+    static const int default_stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+    if (parse_options(argc, argv) != 0) {
+      pid = -1;
+    } else if (opt_watch) {
+      pid = (add_watcher(fd) == 0)?0:-1;
+    } else {
+      pid = spawn_request(argc, argv, nfds?fds:default_stdio, oldset);
+      trace_close();
+    }
+  }
+
+  for(int i=0; i<3; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+
+  char reply[16] = {0};
+  int n = snprintf(reply, sizeof(reply), "%d", pid);
+  if (send(fd, reply, n, MSG_NOSIGNAL) != n) {
+    fprintf(stderr, "error: send reply, %m\n");
+    return -1;
+  }
+
+  return 1;
+}
+
+
+int
+listen_socket(const char *path) {
+  struct sockaddr_un addr = {
+    .sun_family = AF_UNIX,
+  };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: socket path too long '%s'\n", path);
+    return -1;
+  }
+
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "error: socket, %m\n");
+    return -1;
+  }
+
+  if ((unlink(path) != 0) && (errno != ENOENT)) {
+    fprintf(stderr, "error: unlink '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "error: bind '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  if (listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "error: listen '%s', %m\n", path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+int
+serve(const char *path) {
+  sigset_t set, oldset;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+
+  if(sigprocmask(SIG_BLOCK, &set, &oldset) != 0) {
+    fprintf(stderr, "set signal mask, %m\n");
+    return -1;
+  }
+
+  int sfd __attribute__((cleanup(cleanup_fd))) = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC);
+  if (sfd < 0) {
+    fprintf(stderr, "error: create signalfd, %m\n");
+    return -1;
+  }
+
+  int lfd __attribute__((cleanup(cleanup_fd))) = listen_socket(path);
+  if (lfd < 0) {
+    return -1;
+  }
+
+  int efd __attribute__((cleanup(cleanup_fd))) = epoll_create1(EPOLL_CLOEXEC);
+  if (efd < 0) {
+    fprintf(stderr, "error: epoll_create, %m\n");
+    return -1;
+  }
+
+  epoll_fd = efd;
+
+  if ((epoll_add(efd, sfd, EVENT_CLIENT) != 0) || (epoll_add(efd, lfd, EVENT_CLIENT) != 0)) {
+    return -1;
+  }
+
+  for(;;) {
+    struct epoll_event events[16];
+    int n = epoll_wait(efd, events, 16, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "error: epoll_wait, %m\n");
+      return -1;
+    }
+
+    for(int i=0; i<n; i++) {
+      int fd = (int)(uint32_t)events[i].data.u64;
+
+      if ((events[i].data.u64 >> 32) == EVENT_CHILD) {
+        reap_child(fd);
+      } else if (fd == sfd) {
+        struct signalfd_siginfo fdsi;
+        while (read(sfd, &fdsi, sizeof(fdsi)) == sizeof(fdsi));
+        reap_children();
+      } else if (fd == lfd) {
+        int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd < 0) {
+          fprintf(stderr, "error: accept, %m\n");
+          continue;
+        }
+
+        if (epoll_add(efd, cfd, EVENT_CLIENT) != 0) {
+          close(cfd);
+        }
+      } else if (handle_request(fd, &oldset) <= 0) {
+        remove_watcher(fd);
+        epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+      }
+    }
+  }
+}
+
+
+int
+request(const char *path, int argc, char *const argv[]) {
+  char buf[65536];
+  size_t len = 0;
+
+  // parse_options has run, --connect is only stripped from options
+  // before optind, never from the command
+  for(int i=1; i<argc; i++) {
+    if ((i < optind) && (strcmp(argv[i], "--connect") == 0)) {
+      i++;
+      continue;
+    } else if ((i < optind) && (strncmp(argv[i], "--connect=", 10) == 0)) {
+      continue;
+    }
+
+    size_t n = strlen(argv[i]) + 1;
+    if (len + n > sizeof(buf)) {
+      fprintf(stderr, "error: arguments too long\n");
+      return -1;
+    }
+
+    memcpy(buf + len, argv[i], n);
+    len += n;
+  }
+
+  struct sockaddr_un addr = {
+    .sun_family = AF_UNIX,
+  };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: socket path too long '%s'\n", path);
+    return -1;
+  }
+
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd __attribute__((cleanup(cleanup_fd))) = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "error: socket, %m\n");
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "error: connect '%s', %m\n", path);
+    return -1;
+  }
+
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * 3)];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct iovec iov = {
+    .iov_base = buf,
+    .iov_len = len,
+  };
+
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+  static const int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+    fprintf(stderr, "error: sendmsg, %m\n");
+    return -1;
+  }
+
+  char reply[16] = {0};
+  if (recv(fd, reply, sizeof(reply) - 1, 0) <= 0) {
+    fprintf(stderr, "error: recv reply, %m\n");
+    return -1;
+  }
+
+  pid_t pid;
+  if ((sscanf(reply, "%d", &pid) != 1) || (pid < 0)) {
+    fprintf(stderr, "error: daemon failed to spawn process\n");
+    return -1;
+  }
+
+  if (!opt_watch) {
+    return 0;
+  }
+
+  for(;;) {
+    ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+    if (n < 0) {
+      fprintf(stderr, "error: recv event, %m\n");
+      return -1;
+    }
+
+    if (n == 0) {
+      return 0;
+    }
+
+    buf[n] = '\0';
+    printf("%s\n", buf);
+    fflush(stdout);
+  }
+}
+
+
+int
+main(int argc, char *const argv[]) {
+  executable = argv[0];
+
+  if (parse_options(argc, argv) != 0) {
+    goto argument;
+  }
+
+  if (opt_help) {
+    show_usage();
+  }
+
+  if (opt_listen) {
+    return (serve(opt_listen) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+  }
+
+  if (opt_connect) {
+    return (request(opt_connect, argc, argv) == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+  }
+
+  if (!opt_name) {
+    fprintf(stderr, "error: missing name\n");
+    goto argument;
+  }
+
+  opt_domain = (opt_domain)?opt_domain:getenv("USERNS_DOMAIN");
+  opt_domain = (opt_domain)?opt_domain:"localdomain";
+
+  char path[PATH_MAX] = {0};
+  char name[PATH_MAX] = {0};
+
+  if (pidfile_path(path, name) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  if (opt_trace && (trace_open(opt_trace, opt_pidfile?opt_pidfile:opt_name) != 0)) {
+    return EXIT_FAILURE;
+  }
+
+  trace(TRACE_START, 0);
+
+  int cgroup_created = opt_cgroup?prepare_cgroup(opt_cgroup):0;
+  if (cgroup_created < 0) {
+    return EXIT_FAILURE;
+  }
+
+  if (opt_cgroup) {
+    trace(TRACE_CGROUP, 0);
+  }
+
   pid_t pid;
   if (optind < argc) {
     pid = spawn_and_wait(path, name, argv + optind);
   } else {
     char *shell = getenv("SHELL");
-    char *argv[2] = {shell?shell:"/bin/sh", NULL};
-    pid = spawn_and_wait(path, name, argv);
+    char *shell_argv[2] = {shell?shell:"/bin/sh", NULL};
+    pid = spawn_and_wait(path, name, shell_argv);
   }
 
   if (pid < 0) {
+    if (cgroup_created) {
+      rmdir(opt_cgroup);
+    }
     return EXIT_FAILURE;
   }
 
@@ -515,12 +1924,18 @@ main(int argc, char *const argv[]) {
     return EXIT_FAILURE;
   }
 
-  if (WIFSIGNALED(status)) {
-    return WTERMSIG(status) + 128;
-  } else {
-    return WEXITSTATUS(status);
+  int code = WIFSIGNALED(status)?(WTERMSIG(status) + 128):WEXITSTATUS(status);
+
+  if (cgroup_created) {
+    rmdir(opt_cgroup);
   }
 
+  if (opt_exit) {
+    write_exit_status(opt_exit, code, WIFSIGNALED(status)?WTERMSIG(status):0, realtime());
+  }
+
+  return code;
+
 argument:
   fprintf(stderr, "Try '%s --help'\n", executable);
   return EXIT_FAILURE;